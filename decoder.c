@@ -74,6 +74,8 @@ same arguments, and encoder.c does error check.
 #include "cauchy.h"
 #include "liberation.h"
 #include "timing.h"
+#include "multilayer.h"
+#include "ml_io.h"
 
 #define N 10
 #define M 8
@@ -89,22 +91,45 @@ int readins, n;
 /* Function prototype */
 void ctrl_bs_handler(int dummy);
 
+/* For hedged reads: the nodes read so far are enough once they decode. */
+
+static int decodable(int *arrived, void *arg)
+{
+	int erased[ML_NODES];
+	int i, got;
+
+	got = 0;
+	for (i = 0; i < ML_NODES; i++) {
+		erased[i] = !arrived[i];
+		got += arrived[i];
+	}
+	return got >= ML_K && ml_plan_decodable((int *) arg, erased);
+}
+
 int main (int argc, char **argv) {
 	FILE *fp;				// File pointer
 
 	/* Jerasure arguments */
-	char **data;
-	char **coding;
 	int *erasures;
 	int *erased;
 	int *matrix;
 	int *bitmatrix;
 	char **fdata;
-	char **fcoding;
 	char **tempcoding;
 	char **tempdata;
-	char *e;
-	char *e1;
+	char **fnames;			// node file names
+	int *missing;			// nodes whose files are not there
+	ML_Layout lay;			// node file layout, see ml_io.h
+	char **nodebufs;
+	long *nodesizes;
+	double *readsecs;
+	int hedge;			// extra nodes of a hedged read, -1 to read all
+	int *want;			// cells read of each node, or nodes a hedged read asks for
+	int asked, used;
+	char **nodes;
+	ML_Plan plan;
+	ML_Writer out;			// decoded file, see ml_io.h
+	int verified;			// result of the verify and locate pass
 	/* Parameters */
 	int k, m, w, packetsize, buffersize;
 	int tech;
@@ -129,7 +154,7 @@ int main (int argc, char **argv) {
 	struct timing t1, t2, t3, t4,q1,q2,q3,q4,q5,q6;
 	double tsec;
 	double totalsec;
-	double bit_operation_time;
+	double plan_time;
 	double decode_time;
 	double matrix_time;
 	double sum_time;
@@ -146,8 +171,13 @@ int main (int argc, char **argv) {
 	timing_set(&t1);
 
 	/* Error checking parameters */
-	if (argc != 2) {
-		fprintf(stderr, "usage: inputfile\n");
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "usage: inputfile [hedge]\n");
+		exit(0);
+	}
+	hedge = -1;
+	if (argc == 3 && (sscanf(argv[2], "%d", &hedge) != 1 || hedge < 0)) {
+		fprintf(stderr, "hedge must be a number of extra nodes\n");
 		exit(0);
 	}
 	curdir = (char *)malloc(sizeof(char)*1000);
@@ -208,7 +238,15 @@ int main (int argc, char **argv) {
 		fprintf(stderr, "Metadata file - bad format\n");
 		exit(0);
 	}
+	lay.layout = ml_layout_scan(fp);
+	if (lay.layout < 0) {
+		fprintf(stderr, "Metadata file - bad format\n");
+		exit(0);
+	}
 	fclose(fp);	
+	if (ml_check_params(k, m, w) < 0) {
+		exit(0);
+	}
 
 	/* Allocate memory */
 	erased = (int *)malloc(sizeof(int)*(k+m));
@@ -216,26 +254,46 @@ int main (int argc, char **argv) {
 		erased[i] = 0;
 	erasures = (int *)malloc(sizeof(int)*(k+m));
 
-	data = (char **)malloc(sizeof(char *)*k);
-	coding = (char **)malloc(sizeof(char *)*m);
 	tempdata = (char **)malloc(sizeof(char *)*k);
 	tempcoding = (char **)malloc(sizeof(char *)*m);
-	e = (char *)malloc(sizeof(char *)*7);
-	e1 = (char *)malloc(sizeof(char *)*7);			
-	if (buffersize != origsize) {
-		for (i = 0; i < k; i++) {
-			data[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-			tempdata[i] = (char *)malloc(sizeof(char *)*(buffersize/k));
-		}
-		for (i = 0; i < m; i++) {
-			coding[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-			tempcoding[i] = (char *)malloc(sizeof(char)*(buffersize/k));
-		}
-		blocksize = buffersize/k;
-	}
+	fnames = (char **)malloc(sizeof(char *)*(k+m));
+	for (i = 0; i < k+m; i++)
+		fnames[i] = (char *)malloc(sizeof(char)*(100+strlen(argv[1])+20));
+	nodebufs = (char **)malloc(sizeof(char *)*(k+m));
+	nodesizes = (long *)malloc(sizeof(long)*(k+m));
+	readsecs = (double *)malloc(sizeof(double)*(k+m));
+	want = (int *)malloc(sizeof(int)*(k+m));
+	missing = (int *)malloc(sizeof(int)*(k+m));
 
 	sprintf(temp, "%d", k);
 	md = strlen(temp);
+	for (i = 0; i < k+m; i++) {
+		if (i < k) sprintf(fnames[i], "%s/Coding/%s_k%0*d%s", curdir, cs1, md, i, extension);
+		else sprintf(fnames[i], "%s/Coding/%s_m%0*d%s", curdir, cs1, md, i-k, extension);
+	}
+
+	/* Each node file holds readins read-ins of M cells, in the layout the
+	   metadata names; the cell size comes from a file that is there. */
+	ml_find_failed(k+m, fnames, missing);
+	for (i = 0; i < k+m && (missing[i] || stat(fnames[i], &status) != 0); i++) ;
+	if (i == k+m) {
+		fprintf(stderr, "These nodes cannot be decoded\n");
+		exit(1);
+	}
+	blocksize = status.st_size/(M*readins);
+	lay.readins = readins;
+	lay.cells = M;
+	lay.blocksize = blocksize;
+	if (hedge >= 0 && readins != 1) {
+		fprintf(stderr, "Hedged reads take files of one read-in, this one has %d\n", readins);
+		exit(1);
+	}
+	for (i = 0; i < k+m; i++) {
+		nodebufs[i] = (hedge < 0) ? (char *)malloc(sizeof(char)*M*blocksize) : NULL;
+		want[i] = missing[i] ? 0 : (1 << M)-1;
+	}
+	fdata = (char **)malloc(sizeof(char*)*M);
+	for (j = 0; j < M; j++) fdata[j] = (char *)malloc(sizeof(char)*k*blocksize);
 	
         printf("buffersize:%d\n", buffersize);
    
@@ -248,60 +306,11 @@ int main (int argc, char **argv) {
 	/* Create coding matrix or bitmatrix */
 	timing_set(&q5);
 
-int **vandemonde;
-		vandemonde = (int **)malloc(sizeof(int*)*4);
-		for (i = 0; i < 4; i++) {
-		vandemonde[i] = (int *)malloc(sizeof(int)*k);}
-		int *vandemonde11;
-	  	vandemonde11 = (int *)malloc(sizeof(int)*4*k);
-
-		int *p;
-		int *p2group;
-		int *p3group;
-
-		p = (int *)malloc(sizeof(int)*k);
-		p2group = (int *)malloc(sizeof(int)*k);
-		p3group = (int *)malloc(sizeof(int)*k);
-
-
-		       
-memset(p,0,k);
-memset(p2group,0,k);
-memset(p3group,0,k);
-
-
-		      	for(i=0;i<10;i++)  {p[i]=(int)i+1;}
-		
-		        for(i=0;i<10;i++){
-		        galois_w08_region_multiply((p+i), (int)p[i], 1, (p2group+i), 0);}
-		
-			for(i=0;i<10;i++){
-		        galois_w08_region_multiply((p2group+i), (int)p[i], 1, (p3group+i), 0);}
-	
-			for( j=0;j<k;j++){//true
-		        vandemonde[0][j]=(int)1;
-		        vandemonde[1][j]=(int)p[j];
-		        vandemonde[2][j]=(int)p2group[j];
-		        vandemonde[3][j]=(int)p3group[j];
-		        }
-
-
-			for(i=0;i<4;i++){
-			for(i1=0;i1<10;i1++){
-			vandemonde11[i*10+i1]=vandemonde[i][i1];}}
-
-
-
-
-
-
-
 	switch(tech) {
 		case No_Coding:
 			break;
 		case Reed_Sol_Van:
-			//matrix = reed_sol_vandermonde_coding_matrix(k, m, w);
-			matrix = vandemonde11;
+			matrix = ml_coding_matrix(k, m, w);
 			break;
 		case Reed_Sol_R6_Op:
 			matrix = reed_sol_r6_coding_matrix(k, w);
@@ -335,457 +344,127 @@ printf( " 0\n");
 	/* Begin decoding process */
 	total = 0;
 	n = 1;	
+	sprintf(fname, "%s/Coding/%s_decoded%s", curdir, cs1, extension);
+	/* Written to a temporary file, so a decode that fails leaves nothing
+	   behind under the decoded name. */
+	if (ml_writer_open_temp(&out, fname, origsize) < 0) {
+		exit(1);
+	}
 	while (n <= readins) {
 		numerased = 0;
 		/* Open files, check for erasures, read in data/coding */	
 			
-		for (i = 0; i < k; i++) {
-			sprintf(fname, "%s/Coding/%s_k%0*d%s", curdir, cs1, md, i, extension);
-			fp = fopen(fname, "rb");
-			if (fp == NULL) {
-				erased[i] = 1;
-				erasures[numerased] = i;
-				numerased++;}
-				
-			else {
-				if (buffersize == origsize) {
-					stat(fname, &status);
-					blocksize = status.st_size/M;
-					
-					data[i] = (char *)malloc(sizeof(char)*blocksize);
-					tempdata[i] = (char *)malloc(sizeof(char)*M*blocksize);
-					assert(M*blocksize == fread(tempdata[i], sizeof(char), M*blocksize, fp));
-				}
-				
-				fclose(fp);
+		/* The cells of read-in n of every node file there are read at
+		   once; see ml_io.h. */
+		if (hedge < 0) {
+			if (ml_read_cells(k+m, fnames, want, &lay, n-1, 1, nodebufs, nodesizes, readsecs) < 0) {
+				ml_writer_abort(&out);
+				exit(1);
+			}
+			for (i = 0; i < k+m; i++) {
+				if (missing[i]) nodesizes[i] = -1;
+			}
+		} else {
+			/* Hedged: ask k+hedge of the nodes there, data first, and
+			   decode from whichever have arrived once they suffice. */
+			asked = 0;
+			for (i = 0; i < k+m; i++) {
+				want[i] = (asked < k+hedge && !missing[i]);
+				asked += want[i];
+			}
+			timing_set(&t3);
+			used = ml_read_first(k+m, fnames, want, decodable, matrix, nodebufs, nodesizes, readsecs);
+			timing_set(&t4);
+			if (used < 0) {
+				fprintf(stderr, "The nodes read cannot be decoded\n");
+				ml_writer_abort(&out);
+				exit(1);
 			}
+			fprintf(stderr, "Hedged read: asked %d nodes, decoding from %d, %d cancelled, %.10f sec\n",
+			        asked, used, asked-used, timing_delta(&t3, &t4));
 		}
-				
-					
-		for (i = 0; i < m; i++) {
-			sprintf(fname, "%s/Coding/%s_m%0*d%s", curdir, cs1, md, i, extension);
-				fp = fopen(fname, "rb");
-				if (fp == NULL) {
-				erased[k+i] = 1;
-				erasures[numerased] = k+i;
-				numerased++;}	
-			else{
-				if (buffersize == origsize) {
-					stat(fname, &status);
-					blocksize = status.st_size/M;
-					
-					coding[i] = (char *)malloc(sizeof(char)*blocksize);
-					tempcoding[i] = (char *)malloc(sizeof(char)*M*blocksize);
-					assert(M*blocksize == fread(tempcoding[i], sizeof(char), M*blocksize, fp));
-				}
-					
-				fclose(fp);
+		ml_print_read_times(stderr, k+m, fnames, nodesizes, readsecs);
+		for (i = 0; i < k+m; i++) {
+			erased[i] = (nodesizes[i] < 0);
+			if (erased[i]) {
+				erasures[numerased] = i;
+				numerased++;
 			}
+			if (nodebufs[i] == NULL) nodebufs[i] = (char *)malloc(sizeof(char)*M*blocksize);
+			if (i < k) tempdata[i] = nodebufs[i];
+			else tempcoding[i-k] = nodebufs[i];
 		}
 printf("\n");
 printf("blocksize:%d\n", blocksize);
 printf("\n");
-	/* Finish allocating data/coding if needed */
-		if (n == 1) {
-			for (i = 0; i < numerased; i++) {
-				if (erasures[i] < k) {
-					data[erasures[i]] = (char *)malloc(sizeof(char)*blocksize);
-					tempdata[erasures[i]] = (char *)malloc(sizeof(char)*M*blocksize);
-				}
-				else {
-					coding[erasures[i]-k] = (char *)malloc(sizeof(char)*blocksize);
-					tempcoding[erasures[i]-k] = (char *)malloc(sizeof(char)*M*blocksize);
-				}
-			}
-		}
 		erasures[numerased] = -1;
 
 printf( " 1\n");
-fdata = (char **)malloc(sizeof(char*)*M);
-fcoding = (char **)malloc(sizeof(char*)*M);
-for(j = 0; j < M; j++) {
-fdata[j] = (char *)malloc(sizeof(char)*k*blocksize);
-fcoding[j] = (char *)malloc(sizeof(char)*m*blocksize);}
-char **ffdata;
-ffdata = (char **)malloc(sizeof(char*)*M);
-for(j = 0; j < M; j++) {
-ffdata[j] = (char *)malloc(sizeof(char)*k*blocksize);}
-printf( " 2\n");
-                 	for(i=0;i<M;i++){
-                 	for(j1=0;j1<k;j1++){
-                 	for(j=0;j<blocksize;j++){           
-                	 fdata[i][j+j1*blocksize]=*(tempdata[j1]+j+i*blocksize);}}}
-                  	
-   		
-
-printf( " 3\n");
-     			 for(i=0;i<M;i++){
-    			 for(j1=0;j1<m;j1++){
-      			 for(j=0;j<blocksize;j++){
-      			 fcoding[i][j+j1*blocksize]=*(tempcoding[j1]+i*blocksize+j);}}}
 printf( " --------------\n");
 
-                        
-		
-printf( " multiply decoding\n");
-printf( " input data complete\n");
-printf( " bit_operation_start: \n");
-char **extra;
-char **factor;
-char *cons;
-
-
-//char **extra;
-extra = (char **)malloc(sizeof(char*)*64);
-for(i = 0; i < 64; i++) {
-extra[i] = (char *)malloc(sizeof(char)*blocksize);}
-
-
-
+		/* Every uncoupling layer and the RS solve of every sub-stripe run on
+		   one column tile before the next tile is touched, and the decoded
+		   tile goes straight to fdata. */
+		nodes = (char **)malloc(sizeof(char *)*(k+m));
+		for (i = 0; i < k; i++) nodes[i] = tempdata[i];
+		for (i = 0; i < m; i++) nodes[k+i] = tempcoding[i];
 
 timing_set(&q1);
-
-
-
-////////////////////	
-
-
-
-
- for(i=0;i<7;i++){
-               e[0]=20; e[1]=18;e[2]=21;e[3]=16;e[4]=25;e[5]=13;e[6]=54;}   
-      for(i=0;i<7;i++){
-               e1[0]=1; e1[1]=1;e1[2]=1;e1[3]=1;e1[4]=1;e1[5]=1;e1[6]=1;}
-      galois_region_xor(e,e1,7);
-
-for(i=0;i<M;i++){//i=0 2 4 6 8 10 12 14 16..............	
-if( i%2 == 0){
-
-for(i1 = 0; i1< blocksize; i1++){
-extra[i/2][i1]=*(fdata[i+1] + i1);}
-
-
-galois_w8_region_xor(fdata[i+1],(fdata[i] + blocksize),blocksize);
-			
-
-galois_w08_region_multiply((fdata[i] + blocksize), galois_single_divide(1,e1[0],w), blocksize, (fdata[i] + blocksize), 0);
-
-			
-galois_w08_region_multiply((fdata[i] + blocksize),e[0], blocksize, (fdata[i+1]), 0);
-
-
-galois_w8_region_xor(extra[i/2],fdata[i+1],blocksize);//a 1,0  
-}}
-
-
-/////////////////
-
-for(i=0;i<M;i++){	
-if( i%4 == 0){//i= 0 4 
-
-for(j1=0;j1<2;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+2+j1] +2*blocksize+ i1);}}
-
-for(j1=0;j1<2;j1++){
-galois_w8_region_xor((fdata[i+2+j1]+2*blocksize),(fdata[i+j1] + 3*blocksize),blocksize);}
-
-for(j1=0;j1<2;j1++){
-
-
-galois_w08_region_multiply((fdata[i+j1] + 3*blocksize), galois_single_divide(1,e1[1],w), blocksize, (fdata[i+j1] + 3*blocksize), 0);}
-
-
-for(j1=0;j1<2;j1++){
-
-galois_w08_region_multiply((fdata[i+j1] + 3*blocksize), e[1], blocksize, (fdata[i+2+j1]+2*blocksize), 0);}
-
-
-for(j1=0;j1<2;j1++){
-galois_w8_region_xor(extra[j1],(fdata[i+2+j1]+2*blocksize),blocksize);}//a 1,0  
-}}
-
-///////////////////////////
-for(i=0;i<M;i++){	
-if( i%4 == 0){//i= 0 4 
-
-for(j1=0;j1<2;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+2+j1] +4*blocksize+ i1);}}
-
-for(j1=0;j1<2;j1++){
-galois_w8_region_xor((fdata[i+2+j1]+4*blocksize),(fdata[i+j1] + 5*blocksize),blocksize);}
-
-for(j1=0;j1<2;j1++){
-
-
-galois_w08_region_multiply((fdata[i+j1] + 5*blocksize), galois_single_divide(1,e1[2],w), blocksize, (fdata[i+j1] + 5*blocksize), 0);}
-
-
-for(j1=0;j1<2;j1++){
-
-galois_w08_region_multiply((fdata[i+j1] + 5*blocksize), e[2], blocksize, (fdata[i+2+j1]+4*blocksize), 0);}
-
-
-for(j1=0;j1<2;j1++){
-galois_w8_region_xor(extra[j1],(fdata[i+2+j1]+4*blocksize),blocksize);}//a 1,0  
-}}	    
- ////////////////////////////////////////////////////////////////////////if( i%4 == 0){//i= 0 4 8 
-for(i=0;i<M;i++){
-if( i%4 == 0){
-
-
-for(j1=0;j1<2;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+2+j1] +6*blocksize+ i1);}}
-
-for(j1=0;j1<2;j1++){
-galois_w8_region_xor((fdata[i+2+j1]+6*blocksize),(fdata[i+j1] + 7*blocksize),blocksize);}
-
-for(j1=0;j1<2;j1++){
-
-
-galois_w08_region_multiply((fdata[i+j1] + 7*blocksize), galois_single_divide(1,e1[3],w), blocksize, (fdata[i+j1] + 7*blocksize), 0);}
-
-
-for(j1=0;j1<2;j1++){
-
-galois_w08_region_multiply((fdata[i+j1] + 7*blocksize), e[3], blocksize, (fdata[i+2+j1]+6*blocksize), 0);}//}
-
-
-for(j1=0;j1<2;j1++){
-galois_w8_region_xor(extra[j1],(fdata[i+2+j1]+6*blocksize),blocksize);}//a 1,0  
-}}   
-/////////////////////////////////////////////
-for(i=0;i<M;i++){	
-if( i%8 == 0){
-
-for(j1=0;j1<4;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fdata[i+4+j1] +8*blocksize+ i1);}}
-
-
-
-
-for(j1=0;j1<4;j1++){
-galois_w8_region_xor((fdata[i+4+j1]+8*blocksize),(fdata[i+j1] + 9*blocksize),blocksize);}
-
-
-for(j1=0;j1<4;j1++){
-
-
-galois_w08_region_multiply((fdata[i+j1] + 9*blocksize), galois_single_divide(1,e1[4],w), blocksize, (fdata[i+j1] + 9*blocksize), 0);}
-
-
-
-for(j1=0;j1<4;j1++){
-
-galois_w08_region_multiply((fdata[i+j1] + 9*blocksize), e[4], blocksize, (fdata[i+4+j1]+8*blocksize), 0);}//}
-
-
-
-for(j1=0;j1<4;j1++){
-galois_w8_region_xor(extra[j1],(fdata[i+4+j1]+8*blocksize),blocksize);}//a 1,0  
-}}
-/////////////////////////////////////////////////////////
-for(i=0;i<M;i++){	
-if( i%8 == 0){
-
-for(j1=0;j1<4;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fcoding[i+4+j1] + i1);}}
-
-
-
-
-for(j1=0;j1<4;j1++){
-galois_w8_region_xor((fcoding[i+4+j1]),(fcoding[i+j1] + blocksize),blocksize);}
-
-
-for(j1=0;j1<4;j1++){
-
-
-galois_w08_region_multiply((fcoding[i+j1] + blocksize), galois_single_divide(1,e1[5],w), blocksize, (fcoding[i+j1] +blocksize), 0);}
-
-
-
-for(j1=0;j1<4;j1++){
-
-galois_w08_region_multiply((fcoding[i+j1] + blocksize), e[5], blocksize, (fcoding[i+4+j1]), 0);}
-
-
-
-for(j1=0;j1<4;j1++){
-galois_w8_region_xor(extra[j1],(fcoding[i+4+j1]),blocksize);}
-}}
-////////////////////////////////////////////////////
-
-
-
-
-for(i=0;i<M;i++){	
-if( i%8 == 0){
-
-for(j1=0;j1<4;j1++){
-for(i1 = 0; i1< blocksize; i1++) {
-extra[j1][i1]=*(fcoding[i+4+j1] +2*blocksize+ i1);}}
-
-
-
-
-for(j1=0;j1<4;j1++){
-galois_w8_region_xor((fcoding[i+4+j1]+2*blocksize),(fcoding[i+j1] + 3*blocksize),blocksize);}
-
-
-for(j1=0;j1<4;j1++){
-
-
-galois_w08_region_multiply((fcoding[i+j1] + 3*blocksize), galois_single_divide(1,e1[6],w), blocksize, (fcoding[i+j1] + 3*blocksize), 0);}
-
-
-
-for(j1=0;j1<4;j1++){
-
-galois_w08_region_multiply((fcoding[i+j1] + 3*blocksize), e[6], blocksize, (fcoding[i+4+j1]+2*blocksize), 0);}
-
-
-
-for(j1=0;j1<4;j1++){
-galois_w8_region_xor(extra[j1],(fcoding[i+4+j1]+2*blocksize),blocksize);}//a 1,0  
-}}
+		/* Too many nodes are missing to decode at all; this is told apart
+		   from a stripe that reads but whose corrupt nodes cannot be found. */
+		if (!ml_plan_decodable(matrix, erased)) {
+			fprintf(stderr, "These nodes cannot be decoded\n");
+			ml_writer_abort(&out);
+			exit(1);
+		}
+		if (ml_plan_decode(&plan, matrix, erased) < 0) {
+			fprintf(stderr, "Unsuccessful!\n");
+			ml_writer_abort(&out);
+			exit(1);
+		}
 timing_set(&q2);
-//////////////////////////
-			/*printf("\n bit-operation-end \n ");
-			printf("\n fdata 4*10: char \n ");
-		        for(i1=0;i1<4;i1++){
-		        for(j=0;j<10;j++){
-			printf(" %d ",fdata[2*i1][j*blocksize]);}
-			printf("\n");	}
-
-			printf("\n fcoding 4*4: char \n ");
-		        for(i1=0;i1<4;i1++){
-		        for(j=0;j<4;j++){
-			printf(" %d ",fcoding[2*i1][j*blocksize]);}
-			printf("\n");	}*/
-
-
-
-
-/////////////////////
-/*
-        //k=0,1
-        for(i=0;i<M;i++){//
-           for(j=0;j<2;j++){//j=0,1
-             if(erased[j]==0){
-               if(j%2!=0 &&  i%2==0) {  //j =1 i=0,2,4,6                                                       //C1_2+C2_1 xor C1_2e1+c2_1 to C1_2(1+e1)
-		   galois_region_xor(fdata[i+1]+(j-1)*blocksize,fdata[i]+j*blocksize,blocksize);
-                   galois_w08_region_multiply(fdata[i]+j*blocksize,galois_single_divide(1,e1[j/2],w),blocksize,fdata[i]+j*blocksize,0); 
-	       }
-               if(j%2==0 && i%2!=0){ //j=0,i=1,3,5,7
-                   galois_w08_region_multiply((fdata[i-1]+(j+1)*blocksize),e[j/2],blocksize,(ffdata[i-1]+(j+1)*blocksize), 0);
-		   galois_region_xor(ffdata[i-1]+(j+1)*blocksize,fdata[i]+j*blocksize, blocksize);
-               }
-             }
-           }
-        } 
-
-       //k=2,3,4,5,6,7
-       for(i=0;i<M;i++){
-           for(j=2;j<8;j++){//j=2,3,4,5,6,7
-               if(j%2!=0 && (i/2==0 || i/2==2) && erased[j]==0 && erased[j-1]==0) {                                                                 
-		   galois_region_xor(fdata[i+2]+(j-1)*blocksize,fdata[i]+j*blocksize,blocksize);
-                   galois_w08_region_multiply(fdata[i]+j*blocksize,galois_single_divide(1,e1[j/2],w),blocksize,fdata[i]+j*blocksize,0); 
-	       }
-               if(j%2==0 && (i/2==1 || i/2==3) && erased[j]==0 && erased[j+1]==0){ 
-                   galois_w08_region_multiply((fdata[i-2]+(j+1)*blocksize),e[j/2],blocksize,(ffdata[i-2]+(j+1)*blocksize), 0);
-		   galois_region_xor(ffdata[i-2]+(j+1)*blocksize,fdata[i]+j*blocksize, blocksize);
-               }
-           }
-        } 
-
-        //k=8/9
-        for(i=0;i<M;i++){
-           for(j=8;j<10;j++){
-              if(j%2!=0 && i/4==0 && erased[j]==0 && erased[j-1]==0){ 
-                 galois_region_xor(fdata[i+4]+(j-1)*blocksize,fdata[i]+j*blocksize,blocksize);
-                 galois_w08_region_multiply(fdata[i]+j*blocksize,galois_single_divide(1,e1[j/2],w),blocksize,fdata[i]+j*blocksize,0); 
-	        }
-              if(j%2==0 && i/4==1 && erased[j]==0 && erased[j+1]==0){ 
-                   galois_w08_region_multiply((fdata[i-4]+(j+1)*blocksize),e[j/2],blocksize,(ffdata[i-4]+(j+1)*blocksize), 0);
-		   galois_region_xor(ffdata[i-4]+(j+1)*blocksize,fdata[i]+j*blocksize, blocksize);
-		 }
-           }
-        } 
-
-        //k=10/11/12/13 or m=0/1/2/3
-        for(i=0;i<M;i++){
-           for(j=0;j<4;j++){
-              if(j%2!=0 && i/4==0 && erased[k+j]==0 && erased[k+j-1]==0){ 
-                 galois_region_xor(fcoding[i+4]+(j-1)*blocksize,fcoding[i]+j*blocksize,blocksize);
-                 galois_w08_region_multiply(fcoding[i]+j*blocksize,galois_single_divide(1,e1[4+j/2],w),blocksize,fcoding[i]+j*blocksize,0); 
-	      }
-              if(j%2==0 && i/4==1 && erased[k+j]==0 && erased[k+j-1]==0){ 
-                  galois_w08_region_multiply((fcoding[i-4]+(j+1)*blocksize),e[4+j/2],blocksize,(ccoding[i-4]+(j+1)*blocksize), 0);
-		  galois_region_xor(ccoding[i-4]+(j+1)*blocksize,fcoding[i]+j*blocksize, blocksize);
-               }
-           }
-        }  */
 
 printf( "bit_operation_ended \n");
 
   printf( " after operation fdata first strip  :\n");
-	  		
-	
-
-
-
-		
 
 timing_set(&q3);
 printf( "decoding: \n");
 
-		int i3;
-		int ii;
-		int i2;
-		int i4;
-		int jj;
-		int i5;
-	
-		
-		for(ii=0;ii<M;ii++){
-
-		
-		for(jj=0;jj<m;jj++){		
-		coding[jj] = (fcoding[ii]+jj*blocksize);}
-		for(j=0;j<k;j++){
-		data[j] = (fdata[ii]+j*blocksize);}
-
-		
-
-
-
-		/* Choose proper decoding method */
-		if (tech == Reed_Sol_Van || tech == Reed_Sol_R6_Op) {
-			i3 = jerasure_matrix_decode(k, m, w, matrix, 0, erasures, data, coding, blocksize);
-		}
-		if (i3 == -1) {
+		/* Decode out of place and check the stripe against what was read.  A
+		   node whose file is present but silently corrupted is located and
+		   then decoded like an erased one. */
+		verified = ml_decode_verified(&plan, matrix, nodes, blocksize, ML_TILE, erased, fdata);
+		if (verified < 0) {
 			fprintf(stderr, "Unsuccessful!\n");
-			exit(0);
-		}								
-		
-
-
-		/*int p,pp;
-		for(p=0;p<k;p++){
-		for(i2=0;i2<blocksize;i2++){
-		ffdata[ii][pp]=*(data[p]+i2);
-		pp++;}}
-		pp=0;*/
-
-
-
-
-		}//M circle
+			ml_writer_abort(&out);
+			exit(1);
+		}
+		if (verified == 1) {
+			if (ml_locate_corrupt(matrix, nodes, blocksize, ML_TILE, erased) < 0) {
+				fprintf(stderr, "Stripe is inconsistent and the corrupt nodes cannot be located\n");
+				ml_writer_abort(&out);
+				exit(1);
+			}
+			for (i = 0; i < k+m; i++) {
+				for (j = 0; j < numerased && erasures[j] != i; j++) ;
+				if (erased[i] && j == numerased) {
+					fprintf(stderr, "Node %d is corrupt, decoding it as erased\n", i);
+					erasures[numerased] = i;
+					numerased++;
+				}
+			}
+			erasures[numerased] = -1;
+			ml_plan_free(&plan);
+			if (ml_plan_decode(&plan, matrix, erased) < 0 ||
+			    ml_decode_tiled(&plan, matrix, nodes, blocksize, ML_TILE, fdata) < 0) {
+				fprintf(stderr, "Unsuccessful!\n");
+				ml_writer_abort(&out);
+				exit(1);
+			}
+		}
+		ml_plan_free(&plan);
+		free(nodes);
 
 
 
@@ -804,41 +483,12 @@ printf( "decode complete \n");
 
 
 		
-		/* Create decoded file */
-		sprintf(fname, "%s/Coding/%s_decoded%s", curdir, cs1, extension);
-		if (n == 1) {
-			fp = fopen(fname, "wb");
-		}
-		else {
-			fp = fopen(fname, "ab");
-		}
-		
-		for (i4 = 0; i4 < M; i4++) {
-		//for (i1 = 0; i1 < k; i1++) {
-			//if (total+blocksize <= origsize) {
-			//  fwrite(data[i1], sizeof(char), blocksize, fp);
-			 // total+= blocksize;}
-
-			if (total+k*blocksize <= origsize) {
-			   //fwrite(ffdata[i4], sizeof(char), k*blocksize, fp);
-				fwrite(fdata[i4], sizeof(char), k*blocksize, fp);
-			   total+= k*blocksize;}
-			   
-			else {
-				//for (j = 0; j < blocksize; j++) {
-				for (i5 = 0; i5 < k*blocksize; i5++) {
-					if (total < origsize) {
-						//fprintf(fp, "%c", ffdata[i4][i5]);
-						fprintf(fp, "%c", fdata[i4][i5]);
-						total++;
-					}
-					else {
-						break;
-					}
-					
-				}
-			}//else
+		/* Append this read-in to the decoded file */
+		if (ml_write_subs(&out, fdata, M, k*blocksize) < 0) {
+			ml_writer_abort(&out);
+			exit(1);
 		}
+		total += M*k*blocksize;
 
 
 
@@ -859,22 +509,33 @@ printf( " end~\n");
 
 
 		n++;
-		fclose(fp);
 		matrix_time= timing_delta(&q5, &q6);
-		bit_operation_time= timing_delta(&q1, &q2);
+		plan_time= timing_delta(&q1, &q2);
 		decode_time= timing_delta(&q3, &q4);
-		sum_time= matrix_time+bit_operation_time+decode_time;
+		sum_time= matrix_time+plan_time+decode_time;
 
 
 
 	}//while
+	if (ml_writer_close(&out) < 0) {
+		fprintf(stderr, "Error finishing %s\n", fname);
+		exit(1);
+	}
 	
 	/* Free allocated memory */
 	free(cs1);
 	free(extension);
 	free(fname);
-	free(data);
-	free(coding);
+	for (i = 0; i < k+m; i++) {
+		free(nodebufs[i]);
+		free(fnames[i]);
+	}
+	for (j = 0; j < M; j++) free(fdata[j]);
+	free(fdata);
+	free(nodebufs);
+	free(fnames);
+	free(missing);
+	free(want);
 	free(erasures);
 	free(erased);
 	
@@ -883,7 +544,7 @@ printf( " end~\n");
 	tsec = timing_delta(&t1, &t2);
 	printf("Decoding (MB/sec): %0.10f\n", (((double) origsize)/1024.0/1024.0)/sum_time);
 	
-	printf("bit_operation_time (sec): %0.10f\n\n", bit_operation_time);
+	printf("plan_time (sec): %0.10f\n\n", plan_time);
 	printf("decode_time (sec): %0.10f\n\n", decode_time);
 	printf("matrix_time (sec): %0.10f\n\n", matrix_time);
 	printf("sum_time (sec): %0.10f\n\n", sum_time);
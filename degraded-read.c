@@ -0,0 +1,60 @@
+/* degraded-read.c
+ * Reads a byte range of the file of one node of a file encoded by
+ * encoder.c, whether or not that node file is there.
+
+   usage: degraded-read inputfile node offset length
+
+   The bytes go to standard output.  If the node file is missing they come
+   from a repair of it in progress as far as that has got, and the rest is
+   decoded from the other nodes (ml_degraded_read() in ml_repair.h).  Where
+   the bytes came from is printed to standard error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "jerasure.h"
+#include "galois.h"
+#include "multilayer.h"
+#include "ml_io.h"
+#include "ml_repair.h"
+
+int main(int argc, char **argv)
+{
+	char *fnames[ML_NODES], *buf;
+	int *matrix;
+	int node, readins, layout;
+	long off, len, got;
+	ML_Read_Stats st;
+
+	if (argc != 5) {
+		fprintf(stderr, "usage: degraded-read inputfile node offset length\n");
+		exit(0);
+	}
+	if (sscanf(argv[2], "%d", &node) != 1 || node < 0 || node >= ML_NODES ||
+	    sscanf(argv[3], "%ld", &off) != 1 || off < 0 || sscanf(argv[4], "%ld", &len) != 1 || len < 0) {
+		fprintf(stderr, "Bad node or range\n");
+		exit(0);
+	}
+
+	if (ml_object_open(argv[1], fnames, &readins, &layout, NULL) < 0) {
+		exit(1);
+	}
+	matrix = ml_coding_matrix(ML_K, ML_M, ML_W);
+
+	buf = (char *)malloc(sizeof(char)*(len > 0 ? len : 1));
+	got = ml_degraded_read(matrix, fnames, node, readins, layout, off, len, buf, &st);
+	if (got < 0) {
+		fprintf(stderr, "Unsuccessful!\n");
+		exit(1);
+	}
+	if (fwrite(buf, sizeof(char), got, stdout) != (size_t) got) exit(1);
+	fprintf(stderr, "Read %ld bytes: %ld from the node file, %ld from the repair in progress, "
+	        "%ld decoded in %d read-ins\n", got, st.node_bytes, st.cache_bytes, st.decoded_bytes, st.decodes);
+
+	ml_object_free(fnames);
+	free(buf);
+	free(matrix);
+	return 0;
+}
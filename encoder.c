@@ -148,6 +148,7 @@ int main (int argc, char **argv) {
 	int i22,iii;						// loop control variables
 	int blocksize;					// size of k+m files
 	int total;
+	int grouped;					// node file layout, see ml_io.h
 	int extra3;
 	int stripe_size;
 	
@@ -210,11 +211,12 @@ int main (int argc, char **argv) {
 	schedule = NULL;
 	
 	/* Error check Arguments*/
-	if (argc != 8) {
-		fprintf(stderr,  "usage: inputfile k m coding_technique w packetsize buffersize\n");
+	if (argc != 8 && argc != 9) {
+		fprintf(stderr,  "usage: inputfile k m coding_technique w packetsize buffersize [natural|grouped]\n");
 		fprintf(stderr,  "\nChoose one of the following coding techniques: \nreed_sol_van, \nreed_sol_r6_op, \ncauchy_orig, \ncauchy_good, \nliberation, \nblaum_roth, \nliber8tion");
 		fprintf(stderr,  "\n\nPacketsize is ignored for the reed_sol's");
 		fprintf(stderr,  "\nBuffersize of 0 means the buffersize is chosen automatically.\n");
+		fprintf(stderr,  "\nThe grouped layout stores each sub-stripe of all read-ins together in the node files.\n");
 		fprintf(stderr,  "\nIf you just want to test speed, use an inputfile of \"-number\" where number is the size of the fake file you want to test.\n\n");
 		exit(0);
 	}
@@ -240,7 +242,7 @@ int main (int argc, char **argv) {
 			exit(0);
 		}
 	}
-	if (argc != 8) {
+	if (argc < 8) {
 		buffersize = 0;
 	}
 	else {
@@ -250,6 +252,16 @@ int main (int argc, char **argv) {
 		}
 		
 	}
+	grouped = 0;
+	if (argc == 9) {
+		if (strcmp(argv[8], "grouped") == 0) {
+			grouped = 1;
+		}
+		else if (strcmp(argv[8], "natural") != 0) {
+			fprintf(stderr, "Invalid node file layout %s\n", argv[8]);
+			exit(0);
+		}
+	}
 
 	/* Determine proper buffersize by finding the closest valid buffersize to the input value  */
 	if (buffersize != 0) {
@@ -458,7 +470,7 @@ int main (int argc, char **argv) {
 			readins = newsize/buffersize;
 		}
 		block = (char *)malloc(sizeof(char)*buffersize);
-		blocksize = buffersize/k;
+		blocksize = buffersize/(k*M);
 	}
 	else {
 		readins = 1;
@@ -1340,11 +1352,15 @@ printf("bit operation ended \n");
 				if (n == 1) {
 					fp2 = fopen(fname, "wb");
 				}
+				else if (grouped) {
+					fp2 = fopen(fname, "r+b");
+				}
 				else {
 				
 				fp2 = fopen(fname, "ab");
 				}
 				for(j=0;j<M;j++){
+				if (grouped) fseek(fp2, (long) (j*readins + n-1)*blocksize, SEEK_SET);
 				fwrite(&fdata[j][(i)*blocksize], sizeof(char), blocksize, fp2);}
 				
 				fclose(fp2);
@@ -1361,9 +1377,15 @@ printf("bit operation ended \n");
 				//	fp2 = fopen(fname, "wb");
 				//}
 				//else {
+				if (grouped) {
+					fp2 = fopen(fname, (n == 1) ? "wb" : "r+b");
+				}
+				else {
 					fp2 = fopen(fname, "ab");
+				}
 				//}
 				for(j=0;j<M;j++){
+				if (grouped) fseek(fp2, (long) (j*readins + n-1)*blocksize, SEEK_SET);
 				fwrite(&fcoding[j][(i)*blocksize], sizeof(char), blocksize, fp2);}
 				fclose(fp2);
 			}
@@ -1388,6 +1410,7 @@ printf("bit operation ended \n");
 		fprintf(fp2, "%s\n", argv[4]);
 		fprintf(fp2, "%d\n", tech);
 		fprintf(fp2, "%d\n", readins);
+		fprintf(fp2, "%s\n", grouped ? "grouped" : "natural");
 		fclose(fp2);
 	}
 
@@ -0,0 +1,197 @@
+/* hedge-bench.c
+ * Compares waiting for every node with hedged reads (ml_read_first() in
+ * ml_io.h) in the decoding of a file encoded by encoder.c.
+
+   usage: hedge-bench inputfile [trials [hedge]]
+
+   Each trial reads the node files of the stripe and decodes it twice: once
+   reading every node there, as decoder.c does, and once asking only k+hedge
+   of them (2 extra by default) and decoding from the first that suffice.
+   The two decodes are checked against each other.  The time of each, from
+   the first read to the decoded stripe, is collected over trials (100 by
+   default) and the mean, p50, p99 and worst printed.  Run it with
+   ML_IO_DELAY set (ml_io.h) to make some disks slow, e.g.
+   ML_IO_DELAY="*:50:0.02" for a 2% chance of a 50 ms stall on every read.
+   Like decoder.c, it takes a file of a single read-in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "jerasure.h"
+#include "galois.h"
+#include "timing.h"
+#include "multilayer.h"
+#include "ml_io.h"
+
+static int decodable(int *arrived, void *arg)
+{
+	int erased[ML_NODES];
+	int i, got;
+
+	got = 0;
+	for (i = 0; i < ML_NODES; i++) {
+		erased[i] = !arrived[i];
+		got += arrived[i];
+	}
+	return got >= ML_K && ml_plan_decodable((int *) arg, erased);
+}
+
+/* Decodes the nodes in bufs (NULL where not read) into fdata; returns -1
+   if they do not decode. */
+
+static int decode(int *matrix, char **bufs, long *sizes, long blocksize, char **fdata)
+{
+	ML_Plan plan;
+	char *nodes[ML_NODES];
+	int erased[ML_NODES];
+	int i, rv;
+
+	for (i = 0; i < ML_NODES; i++) {
+		erased[i] = (bufs[i] == NULL || sizes[i] != ML_SUBS*blocksize);
+		nodes[i] = erased[i] ? (char *)malloc(sizeof(char)*ML_SUBS*blocksize) : bufs[i];
+	}
+	rv = -1;
+	if (ml_plan_decode(&plan, matrix, erased) == 0) {
+		rv = ml_decode_tiled(&plan, matrix, nodes, blocksize, ML_TILE, fdata);
+		ml_plan_free(&plan);
+	}
+	for (i = 0; i < ML_NODES; i++) {
+		if (erased[i]) free(nodes[i]);
+	}
+	return rv;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x, y;
+
+	x = *(double *) a;
+	y = *(double *) b;
+	return (x > y) - (x < y);
+}
+
+/* The q-th percentile of n sorted times. */
+
+static double percentile(double *t, int n, int q)
+{
+	return t[(n*q)/100 < n ? (n*q)/100 : n-1];
+}
+
+/* Sorts the times and prints them. */
+
+static void print_times(char *name, double *t, int trials)
+{
+	double sum;
+	int i;
+
+	sum = 0;
+	for (i = 0; i < trials; i++) sum += t[i];
+	qsort(t, trials, sizeof(double), compare_doubles);
+	printf("%-8s mean %.6f  p50 %.6f  p99 %.6f  worst %.6f sec\n", name, sum/trials,
+	       percentile(t, trials, 50), percentile(t, trials, 99), t[trials-1]);
+}
+
+int main(int argc, char **argv)
+{
+	struct timing t1, t2;
+	struct stat status;
+	char *fnames[ML_NODES], *bufs[ML_NODES], *fdata[ML_SUBS], *hdata[ML_SUBS];
+	long sizes[ML_NODES];
+	double secs[ML_NODES];
+	double *full, *hedged, p50, p99;
+	int *matrix;
+	int want[ML_NODES];
+	int readins;
+	int i, j, trials, hedge, asked, used, bad;
+	long blocksize;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "usage: hedge-bench inputfile [trials [hedge]]\n");
+		exit(0);
+	}
+	trials = 100;
+	hedge = 2;
+	if ((argc > 2 && (sscanf(argv[2], "%d", &trials) != 1 || trials < 1)) ||
+	    (argc > 3 && (sscanf(argv[3], "%d", &hedge) != 1 || hedge < 0))) {
+		fprintf(stderr, "Bad trials or hedge\n");
+		exit(0);
+	}
+
+	if (ml_object_open(argv[1], fnames, &readins, NULL, NULL) < 0) {
+		exit(1);
+	}
+	if (readins != 1) {
+		fprintf(stderr, "hedge-bench takes files of one read-in, this one has %d\n", readins);
+		exit(0);
+	}
+	matrix = ml_coding_matrix(ML_K, ML_M, ML_W);
+
+	asked = 0;
+	blocksize = -1;
+	for (i = 0; i < ML_NODES; i++) {
+		want[i] = (asked < ML_K+hedge && stat(fnames[i], &status) == 0);
+		asked += want[i];
+		if (want[i] && blocksize < 0) blocksize = status.st_size/ML_SUBS;
+	}
+	if (blocksize <= 0) {
+		fprintf(stderr, "No node files\n");
+		exit(1);
+	}
+	for (i = 0; i < ML_SUBS; i++) {
+		fdata[i] = (char *)malloc(sizeof(char)*ML_K*blocksize);
+		hdata[i] = (char *)malloc(sizeof(char)*ML_K*blocksize);
+	}
+	full = (double *)malloc(sizeof(double)*trials);
+	hedged = (double *)malloc(sizeof(double)*trials);
+
+	bad = 0;
+	used = 0;
+	for (j = 0; j < trials; j++) {
+		timing_set(&t1);
+		if (ml_read_nodes(ML_NODES, fnames, bufs, sizes, secs) < 0 ||
+		    decode(matrix, bufs, sizes, blocksize, fdata) < 0) {
+			fprintf(stderr, "Unsuccessful!\n");
+			exit(1);
+		}
+		timing_set(&t2);
+		full[j] = timing_delta(&t1, &t2);
+		for (i = 0; i < ML_NODES; i++) free(bufs[i]);
+
+		timing_set(&t1);
+		used = ml_read_first(ML_NODES, fnames, want, decodable, matrix, bufs, sizes, secs);
+		if (used < 0 || decode(matrix, bufs, sizes, blocksize, hdata) < 0) {
+			fprintf(stderr, "Unsuccessful!\n");
+			exit(1);
+		}
+		timing_set(&t2);
+		hedged[j] = timing_delta(&t1, &t2);
+		for (i = 0; i < ML_NODES; i++) free(bufs[i]);
+		for (i = 0; i < ML_SUBS; i++) {
+			if (memcmp(fdata[i], hdata[i], ML_K*blocksize) != 0) {
+				bad++;
+				break;
+			}
+		}
+	}
+
+	printf("%d trials, hedged reads ask %d nodes\n", trials, asked);
+	print_times("all", full, trials);
+	print_times("hedged", hedged, trials);
+	p50 = percentile(full, trials, 50)/percentile(hedged, trials, 50);
+	p99 = percentile(full, trials, 99)/percentile(hedged, trials, 99);
+	printf("Speedup: p50 %.2fx, p99 %.2fx\n", p50, p99);
+	if (bad > 0) printf("%d hedged decodes differ\n", bad);
+
+	ml_object_free(fnames);
+	for (i = 0; i < ML_SUBS; i++) {
+		free(fdata[i]);
+		free(hdata[i]);
+	}
+	free(full);
+	free(hedged);
+	free(matrix);
+	return bad > 0;
+}
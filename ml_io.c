@@ -0,0 +1,1217 @@
+/* ml_io.c
+ * Node file I/O shared by decoder.c and the repair programs.  See ml_io.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "timing.h"
+#include "multilayer.h"
+#include "ml_io.h"
+
+char *ml_layout_names[ML_LAYOUTS] = { "natural", "grouped" };
+
+/* A run of bytes that is contiguous both in the file and in the buffer. */
+
+typedef struct {
+  long off;
+  char *buf;
+  long len;
+} Extent;
+
+/* The reads of one ml_read_first(), which go on until cancelled. */
+
+typedef struct {
+  int cancel;
+  int finished;                 /* Reads over, whole or not */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} Hedge;
+
+typedef struct {
+  int fd;
+  char *buf;
+  long size;                    /* Whole file, or ... */
+  Extent *ext;                  /* ... these extents, if not NULL */
+  int next;
+  long bytes;
+  double sec;
+  int err;
+  int disk;                     /* Throttle of its disk, or -1 */
+  int node;                     /* For injected delays, or -1 */
+  Hedge *hedge;                 /* Of ml_read_first(), or NULL */
+  int whole;                    /* Read to the end, for ml_read_first() */
+} Node_Read;
+
+/* Injected delays (ML_IO_DELAY), read on first use.  node is -1 for any. */
+
+static struct {
+  int parsed;
+  int n;
+  struct {
+    int node;
+    double sec, p;
+  } item[ML_IO_DELAYS];
+  pthread_mutex_t lock;
+} delays = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* I/O throttling (ml_qos_open()).  A bucket holds up to a tenth of a
+   second of its rate, and may go into debt by one large request; the next
+   one waits until it is paid back.  A rate of 0 is no limit. */
+
+typedef struct {
+  double rate;
+  double tokens;
+  double last;
+} Bucket;
+
+typedef struct {
+  dev_t dev;
+  char *probe;                  /* A file on the disk to time reads of */
+  double rate, iops;            /* From the control file */
+  Bucket bytes, ios;
+  double scale;                 /* Backoff, 1 when not backing off */
+  double base;                  /* Byte rate backed off from if none is set */
+  long moved;                   /* Bytes since the last probe */
+  double probed;
+  int probing;
+} Disk;
+
+typedef struct {
+  dev_t dev;
+  double rate, iops;
+} Disk_Limit;
+
+static struct {
+  int on;
+  char *control;
+  time_t mtime;
+  off_t size;
+  double checked;
+  double rate, iops;            /* Global */
+  double disk_rate, disk_iops;  /* Every disk not named */
+  Disk_Limit named[ML_QOS_DISKS];
+  int nnamed;
+  double latency;               /* Seconds, 0 for no backoff */
+  double interval;
+  char observed[960];           /* File of foreground latencies, or "" */
+  Bucket bytes, ios;
+  Disk disks[ML_QOS_DISKS];
+  int ndisks;
+  double waited;
+  int backoffs;
+  pthread_mutex_t lock;
+} qos = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static double qos_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void bucket_set(Bucket *b, double rate, double now)
+{
+  if (b->rate == 0 || b->tokens > rate/10) b->tokens = rate/10;
+  b->rate = rate;
+  b->last = now;
+}
+
+/* Seconds until b can take one more request. */
+
+static double bucket_wait(Bucket *b, double now)
+{
+  if (b->rate <= 0) return 0;
+  b->tokens += (now - b->last)*b->rate;
+  if (b->tokens > b->rate/10) b->tokens = b->rate/10;
+  b->last = now;
+  return (b->tokens >= 0) ? 0 : -b->tokens/b->rate;
+}
+
+static double scaled(double rate, double scale)
+{
+  return (rate > 0) ? rate*scale : 0;
+}
+
+/* Sets the buckets of d from the limits and its backoff. */
+
+static void disk_apply(Disk *d, double now)
+{
+  double rate, iops;
+  int x;
+
+  rate = qos.disk_rate;
+  iops = qos.disk_iops;
+  for (x = 0; x < qos.nnamed; x++) {
+    if (qos.named[x].dev == d->dev) {
+      rate = qos.named[x].rate;
+      iops = qos.named[x].iops;
+    }
+  }
+  d->rate = rate;
+  d->iops = iops;
+  if (rate <= 0 && d->scale < 1) rate = d->base;
+  rate = scaled(rate, d->scale);
+  iops = scaled(iops, d->scale);
+  if (d->scale < 1 && rate > 0 && rate < ML_QOS_MIN_RATE) rate = ML_QOS_MIN_RATE;
+  if (d->scale < 1 && iops > 0 && iops < ML_QOS_MIN_IOPS) iops = ML_QOS_MIN_IOPS;
+  bucket_set(&d->bytes, rate, now);
+  bucket_set(&d->ios, iops, now);
+}
+
+static double parse_rate(char *s)
+{
+  char *end;
+  double v;
+
+  v = strtod(s, &end);
+  if (*end == 'K' || *end == 'k') v *= 1024;
+  else if (*end == 'M' || *end == 'm') v *= 1024*1024;
+  else if (*end == 'G' || *end == 'g') v *= 1024*1024*1024;
+  return (v > 0) ? v : 0;
+}
+
+/* Reads the control file if it changed since the last look.  Called with
+   the lock held. */
+
+static void qos_reload(double now)
+{
+  struct stat status;
+  FILE *fp;
+  char line[1024], key[32], path[960], *p;
+  double a, b;
+  int x;
+
+  qos.checked = now;
+  if (stat(qos.control, &status) < 0) return;
+  if (status.st_mtime == qos.mtime && status.st_size == qos.size) return;
+  fp = fopen(qos.control, "r");
+  if (fp == NULL) return;
+  qos.mtime = status.st_mtime;
+  qos.size = status.st_size;
+
+  qos.rate = qos.iops = qos.disk_rate = qos.disk_iops = 0;
+  qos.nnamed = 0;
+  qos.latency = 0;
+  qos.interval = ML_QOS_PROBE;
+  qos.observed[0] = '\0';
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || *p == '\0') continue;
+    if (sscanf(p, "rate %31s", key) == 1) qos.rate = parse_rate(key);
+    else if (sscanf(p, "iops %lf", &a) == 1) qos.iops = (a > 0) ? a : 0;
+    else if (sscanf(p, "latency %lf %lf", &a, &b) == 2) {
+      qos.latency = a/1000;
+      qos.interval = b/1000;
+    } else if (sscanf(p, "latency %lf", &a) == 1) qos.latency = a/1000;
+    else if (sscanf(p, "observed %959s", path) == 1) strcpy(qos.observed, path);
+    else if (sscanf(p, "disk %959s %31s", path, key) == 2) {
+      a = parse_rate(key);
+      if (sscanf(p, "disk %*s %*s %lf", &b) != 1 || b < 0) b = 0;
+      if (strcmp(path, "*") == 0) {
+        qos.disk_rate = a;
+        qos.disk_iops = b;
+        continue;
+      }
+      if (stat(path, &status) < 0) {
+        fprintf(stderr, "%s: no disk %s\n", qos.control, path);
+        continue;
+      }
+      for (x = 0; x < qos.nnamed && qos.named[x].dev != status.st_dev; x++) ;
+      if (x == ML_QOS_DISKS) continue;
+      if (x == qos.nnamed) qos.nnamed++;
+      qos.named[x].dev = status.st_dev;
+      qos.named[x].rate = a;
+      qos.named[x].iops = b;
+    } else {
+      p[strcspn(p, "\n")] = '\0';
+      fprintf(stderr, "%s: ignored \"%s\"\n", qos.control, p);
+    }
+  }
+  fclose(fp);
+  if (qos.interval <= 0) qos.interval = ML_QOS_PROBE;
+
+  bucket_set(&qos.bytes, qos.rate, now);
+  bucket_set(&qos.ios, qos.iops, now);
+  for (x = 0; x < qos.ndisks; x++) {
+    if (qos.latency <= 0) qos.disks[x].scale = 1;
+    disk_apply(qos.disks + x, now);
+  }
+}
+
+/* Seconds one 4 KB read from a random block of fname takes, past the page
+   cache where the system allows, or -1. */
+
+static double qos_probe(char *fname)
+{
+  struct stat status;
+  char *buf;
+  double t;
+  off_t off;
+  int fd;
+
+  fd = -1;
+#ifdef O_DIRECT
+  fd = open(fname, O_RDONLY | O_DIRECT);
+#endif
+  if (fd < 0) fd = open(fname, O_RDONLY);
+  if (fd < 0) return -1;
+  if (fstat(fd, &status) < 0 || status.st_size < 4096 || posix_memalign((void **) &buf, 4096, 4096) != 0) {
+    close(fd);
+    return -1;
+  }
+  off = (off_t) (rand() % (status.st_size/4096)) * 4096;
+#ifdef POSIX_FADV_DONTNEED
+  posix_fadvise(fd, off, 4096, POSIX_FADV_DONTNEED);
+#endif
+  t = qos_now();
+  t = (pread(fd, buf, 4096, off) > 0) ? qos_now() - t : -1;
+  free(buf);
+  close(fd);
+  return t;
+}
+
+/* Seconds of the foreground read latency of the disk dev in the file
+   fname, lines of a path on the disk, or *, and milliseconds, or -1 if the
+   file does not name it. */
+
+static double qos_observed(char *fname, dev_t dev)
+{
+  struct stat status;
+  FILE *fp;
+  char line[1024], path[960];
+  double ms, any, t;
+
+  fp = fopen(fname, "r");
+  if (fp == NULL) return -1;
+  any = t = -1;
+  while (t < 0 && fgets(line, sizeof(line), fp) != NULL) {
+    if (sscanf(line, "%959s %lf", path, &ms) != 2 || ms < 0) continue;
+    if (strcmp(path, "*") == 0) any = ms/1000;
+    else if (stat(path, &status) == 0 && status.st_dev == dev) t = ms/1000;
+  }
+  fclose(fp);
+  return (t >= 0) ? t : any;
+}
+
+/* Halves the rates of d when a probe took longer than the threshold, and
+   gives back a sixteenth a probe when it did not.  With no byte rate set
+   for the disk, the rate it is backed off from is the one it had reached.
+   Called with the lock held. */
+
+static void qos_backoff(Disk *d, double lat, double now)
+{
+  double elapsed;
+
+  elapsed = now - d->probed;
+  d->probed = now;
+  if (lat < 0) return;
+  if (lat > qos.latency) {
+    if (d->scale == 1 && d->rate <= 0) {
+      if (d->moved == 0) return;
+      d->base = d->moved/elapsed;
+    }
+    if (d->scale > 1.0/64) d->scale /= 2;
+    qos.backoffs++;
+  } else if (d->scale < 1) {
+    d->scale += 1.0/16;
+    if (d->scale >= 1) d->scale = 1;
+  }
+  d->moved = 0;
+  disk_apply(d, now);
+}
+
+/* The throttle of the disk holding fd, taken on for the first time with
+   fname to probe.  -1 if throttling is off. */
+
+static int qos_disk(char *fname, int fd)
+{
+  struct stat status;
+  Disk *d;
+  int x;
+
+  if (!qos.on || fstat(fd, &status) < 0) return -1;
+  pthread_mutex_lock(&qos.lock);
+  for (x = 0; x < qos.ndisks && qos.disks[x].dev != status.st_dev; x++) ;
+  if (x == qos.ndisks && x < ML_QOS_DISKS) {
+    d = qos.disks + x;
+    memset(d, 0, sizeof(Disk));
+    d->dev = status.st_dev;
+    d->probe = strdup(fname);
+    d->scale = 1;
+    d->probed = qos_now();
+    disk_apply(d, d->probed);
+    qos.ndisks++;
+  }
+  if (x == qos.ndisks) x = -1;
+  pthread_mutex_unlock(&qos.lock);
+  return x;
+}
+
+/* Waits until one request of len bytes to disk fits in every bucket, and
+   takes it out of them. */
+
+static void qos_take(int disk, long len)
+{
+  struct timespec ts;
+  Disk *d;
+  double now, wait, w, lat;
+  char observed[960];
+
+  if (!qos.on) return;
+  pthread_mutex_lock(&qos.lock);
+  d = (disk >= 0) ? qos.disks + disk : NULL;
+  while (1) {
+    now = qos_now();
+    if (now - qos.checked >= ML_QOS_RELOAD) qos_reload(now);
+    if (d != NULL && qos.latency > 0 && !d->probing && now - d->probed >= qos.interval) {
+      d->probing = 1;
+      strcpy(observed, qos.observed);
+      pthread_mutex_unlock(&qos.lock);
+      if (*observed == '\0' || (lat = qos_observed(observed, d->dev)) < 0) lat = qos_probe(d->probe);
+      pthread_mutex_lock(&qos.lock);
+      d->probing = 0;
+      qos_backoff(d, lat, qos_now());
+      continue;
+    }
+    wait = bucket_wait(&qos.bytes, now);
+    if ((w = bucket_wait(&qos.ios, now)) > wait) wait = w;
+    if (d != NULL && (w = bucket_wait(&d->bytes, now)) > wait) wait = w;
+    if (d != NULL && (w = bucket_wait(&d->ios, now)) > wait) wait = w;
+    if (wait <= 0) break;
+    qos.waited += wait;
+    pthread_mutex_unlock(&qos.lock);
+    ts.tv_sec = (time_t) wait;
+    ts.tv_nsec = (long) ((wait - ts.tv_sec)*1e9);
+    nanosleep(&ts, NULL);
+    pthread_mutex_lock(&qos.lock);
+  }
+  qos.bytes.tokens -= len;
+  qos.ios.tokens -= 1;
+  if (d != NULL) {
+    d->bytes.tokens -= len;
+    d->ios.tokens -= 1;
+    d->moved += len;
+  }
+  pthread_mutex_unlock(&qos.lock);
+}
+
+int ml_layout_parse(char *name)
+{
+  int i;
+
+  for (i = 0; i < ML_LAYOUTS; i++) {
+    if (strcmp(name, ml_layout_names[i]) == 0) return i;
+  }
+  return -1;
+}
+
+int ml_layout_scan(FILE *fp)
+{
+  char name[32];
+
+  if (fscanf(fp, "%31s", name) != 1) return ML_LAYOUT_NATURAL;
+  return ml_layout_parse(name);
+}
+
+long ml_layout_offset(ML_Layout *lay, int n, int t)
+{
+  if (lay->layout == ML_LAYOUT_GROUPED) return ((long) t*lay->readins + n)*lay->blocksize;
+  return ((long) n*lay->cells + t)*lay->blocksize;
+}
+
+/* Extents of columns [col, col+width) of the cells in mask of read-ins
+   n..n+nb-1, buffer laid out as for ml_read_cols().  Column x of a cell is
+   byte x%blocksize of that cell in read-in n+x/blocksize.  Returns how many,
+   at most cells*nb. */
+
+static int cell_extents(ML_Layout *lay, int mask, int n, int nb, long col, long width, char *buf,
+                        Extent *ext)
+{
+  Extent *e;
+  long off, lo, hi, bs;
+  char *b;
+  int t, j, next;
+
+  next = 0;
+  bs = lay->blocksize;
+  for (t = 0; t < lay->cells; t++) {
+    if (!((mask >> t) & 1)) continue;
+    for (j = 0; j < nb; j++) {
+      lo = (j*bs > col) ? j*bs : col;
+      hi = ((j+1)*bs < col+width) ? (j+1)*bs : col+width;
+      if (lo >= hi) continue;
+      off = ml_layout_offset(lay, n+j, t) + lo - j*bs;
+      b = buf + t*width + lo - col;
+      e = (next > 0) ? ext + next - 1 : NULL;
+      if (e != NULL && e->off + e->len == off && e->buf + e->len == b) {
+        e->len += hi-lo;
+      } else {
+        ext[next].off = off;
+        ext[next].buf = b;
+        ext[next].len = hi-lo;
+        next++;
+      }
+    }
+  }
+  return next;
+}
+
+static void delays_parse(void)
+{
+  char *spec, *item, *save, *s;
+  double ms, p;
+  int node;
+
+  delays.parsed = 1;
+  spec = getenv(ML_IO_DELAY);
+  if (spec == NULL || (spec = strdup(spec)) == NULL) return;
+  for (item = strtok_r(spec, ",", &save); item != NULL && delays.n < ML_IO_DELAYS;
+       item = strtok_r(NULL, ",", &save)) {
+    node = -1;
+    if (item[0] != '*' && sscanf(item, "%d", &node) != 1) continue;
+    s = strchr(item, ':');
+    p = 1;
+    if (s == NULL || sscanf(s+1, "%lf", &ms) != 1 || ms < 0) continue;
+    s = strchr(s+1, ':');
+    if (s != NULL && sscanf(s+1, "%lf", &p) != 1) continue;
+    delays.item[delays.n].node = node;
+    delays.item[delays.n].sec = ms/1000;
+    delays.item[delays.n].p = p;
+    delays.n++;
+  }
+  free(spec);
+}
+
+static int hedge_cancelled(Hedge *h)
+{
+  int c;
+
+  if (h == NULL) return 0;
+  pthread_mutex_lock(&h->lock);
+  c = h->cancel;
+  pthread_mutex_unlock(&h->lock);
+  return c;
+}
+
+/* Waits as ML_IO_DELAY says for a read of node, a millisecond at a time
+   so that a cancelled read stops at once. */
+
+static void inject_delay(int node, Hedge *h)
+{
+  struct timespec ts;
+  double wait, end, now;
+  int i;
+
+  wait = 0;
+  pthread_mutex_lock(&delays.lock);
+  if (!delays.parsed) delays_parse();
+  for (i = 0; i < delays.n; i++) {
+    if (delays.item[i].node >= 0 && delays.item[i].node != node) continue;
+    if (delays.item[i].p < 1 && rand() >= delays.item[i].p*((double) RAND_MAX+1)) continue;
+    if (delays.item[i].sec > wait) wait = delays.item[i].sec;
+  }
+  pthread_mutex_unlock(&delays.lock);
+  if (wait <= 0) return;
+  end = qos_now() + wait;
+  while ((now = qos_now()) < end && !hedge_cancelled(h)) {
+    ts.tv_sec = 0;
+    ts.tv_nsec = (end-now < 0.001) ? (long) ((end-now)*1e9) : 1000000;
+    nanosleep(&ts, NULL);
+  }
+}
+
+static int pread_full(int fd, char *buf, long len, long off)
+{
+  ssize_t got;
+  long done;
+
+  done = 0;
+  while (done < len) {
+    got = pread(fd, buf+done, len-done, off+done);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) return -1;
+    done += got;
+  }
+  return 0;
+}
+
+/* Reads the whole file, or each extent with one pread().  The whole file
+   of a hedged read goes ML_HEDGE_CHUNK bytes at a time, until cancelled. */
+
+static void *read_node(void *arg)
+{
+  Node_Read *nr;
+  struct timing t1, t2;
+  long len;
+  int x;
+
+  nr = (Node_Read *) arg;
+  timing_set(&t1);
+  nr->bytes = 0;
+  if (nr->node >= 0) inject_delay(nr->node, nr->hedge);
+  if (nr->ext == NULL && nr->hedge != NULL) {
+    while (nr->bytes < nr->size && !nr->err && !hedge_cancelled(nr->hedge)) {
+      len = (nr->size - nr->bytes < ML_HEDGE_CHUNK) ? nr->size - nr->bytes : ML_HEDGE_CHUNK;
+      qos_take(nr->disk, len);
+      if (pread_full(nr->fd, nr->buf + nr->bytes, len, nr->bytes) < 0) nr->err = 1;
+      else nr->bytes += len;
+    }
+  } else if (nr->ext == NULL) {
+    qos_take(nr->disk, nr->size);
+    if (pread_full(nr->fd, nr->buf, nr->size, 0) < 0) nr->err = 1;
+    else nr->bytes = nr->size;
+  } else {
+    for (x = 0; x < nr->next && !nr->err; x++) {
+      qos_take(nr->disk, nr->ext[x].len);
+      if (pread_full(nr->fd, nr->ext[x].buf, nr->ext[x].len, nr->ext[x].off) < 0) {
+        nr->err = 1;
+      } else {
+        nr->bytes += nr->ext[x].len;
+      }
+    }
+  }
+  timing_set(&t2);
+  nr->sec = timing_delta(&t1, &t2);
+  if (nr->hedge != NULL) {
+    pthread_mutex_lock(&nr->hedge->lock);
+    nr->whole = (!nr->err && nr->bytes == nr->size);
+    nr->hedge->finished++;
+    pthread_cond_signal(&nr->hedge->cond);
+    pthread_mutex_unlock(&nr->hedge->lock);
+  }
+  return NULL;
+}
+
+/* Runs read_node() on one thread per open file and closes the files. */
+
+static int run_reads(Node_Read *nr, int nnodes, char **fnames)
+{
+  pthread_t *tids;
+  int *started;
+  int i, rv;
+
+  tids = (pthread_t *) malloc(sizeof(pthread_t)*nnodes);
+  started = (int *) malloc(sizeof(int)*nnodes);
+  if (tids == NULL || started == NULL) {
+    free(tids);
+    free(started);
+    return -1;
+  }
+  for (i = 0; i < nnodes; i++) {
+    started[i] = 0;
+    if (nr[i].fd < 0 || nr[i].err) continue;
+    if (pthread_create(tids+i, NULL, read_node, nr+i) == 0) {
+      started[i] = 1;
+    } else {
+      read_node(nr+i);
+    }
+  }
+  rv = 0;
+  for (i = 0; i < nnodes; i++) {
+    if (nr[i].fd < 0) continue;
+    if (started[i]) pthread_join(tids[i], NULL);
+    close(nr[i].fd);
+    if (nr[i].err) {
+      fprintf(stderr, "Error reading %s\n", fnames[i]);
+      rv = -1;
+    }
+  }
+  free(tids);
+  free(started);
+  return rv;
+}
+
+int ml_read_nodes(int nnodes, char **fnames, char **bufs, long *sizes, double *secs)
+{
+  Node_Read *nr;
+  struct stat status;
+  int i, nread, rv;
+
+  nr = (Node_Read *) malloc(sizeof(Node_Read)*nnodes);
+  if (nr == NULL) return -1;
+
+  /* Open everything and hand out the readahead hints before the first read,
+     so the disks start on all survivors at once. */
+
+  for (i = 0; i < nnodes; i++) {
+    bufs[i] = NULL;
+    sizes[i] = -1;
+    secs[i] = 0;
+    nr[i].fd = open(fnames[i], O_RDONLY);
+    if (nr[i].fd < 0) continue;
+    if (fstat(nr[i].fd, &status) < 0) {
+      close(nr[i].fd);
+      nr[i].fd = -1;
+      continue;
+    }
+    nr[i].size = status.st_size;
+    nr[i].ext = NULL;
+    nr[i].node = i;
+    nr[i].hedge = NULL;
+    nr[i].disk = qos_disk(fnames[i], nr[i].fd);
+    nr[i].buf = (char *) malloc(nr[i].size > 0 ? nr[i].size : 1);
+    nr[i].err = (nr[i].buf == NULL);
+    nr[i].sec = 0;
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(nr[i].fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+  }
+
+  rv = run_reads(nr, nnodes, fnames);
+  nread = 0;
+  for (i = 0; i < nnodes; i++) {
+    if (nr[i].fd < 0) continue;
+    if (nr[i].err) {
+      free(nr[i].buf);
+      continue;
+    }
+    bufs[i] = nr[i].buf;
+    sizes[i] = nr[i].size;
+    secs[i] = nr[i].sec;
+    nread++;
+  }
+  free(nr);
+  return (rv < 0) ? -1 : nread;
+}
+
+int ml_read_first(int nnodes, char **fnames, int *want, int (*enough)(int *arrived, void *arg),
+                  void *arg, char **bufs, long *sizes, double *secs)
+{
+  Node_Read *nr;
+  Hedge h;
+  struct stat status;
+  pthread_t *tids;
+  int *started, *arrived;
+  int i, nstarted, seen, ok, nread;
+
+  nr = (Node_Read *) malloc(sizeof(Node_Read)*nnodes);
+  tids = (pthread_t *) malloc(sizeof(pthread_t)*nnodes);
+  started = (int *) malloc(sizeof(int)*nnodes);
+  arrived = (int *) malloc(sizeof(int)*nnodes);
+  if (nr == NULL || tids == NULL || started == NULL || arrived == NULL) {
+    free(nr);
+    free(tids);
+    free(started);
+    free(arrived);
+    return -1;
+  }
+  h.cancel = 0;
+  h.finished = 0;
+  pthread_mutex_init(&h.lock, NULL);
+  pthread_cond_init(&h.cond, NULL);
+
+  for (i = 0; i < nnodes; i++) {
+    bufs[i] = NULL;
+    sizes[i] = -1;
+    secs[i] = 0;
+    arrived[i] = 0;
+    started[i] = 0;
+    nr[i].fd = want[i] ? open(fnames[i], O_RDONLY) : -1;
+    if (nr[i].fd < 0) continue;
+    if (fstat(nr[i].fd, &status) < 0) {
+      close(nr[i].fd);
+      nr[i].fd = -1;
+      continue;
+    }
+    nr[i].size = status.st_size;
+    nr[i].ext = NULL;
+    nr[i].node = i;
+    nr[i].hedge = &h;
+    nr[i].whole = 0;
+    nr[i].disk = qos_disk(fnames[i], nr[i].fd);
+    nr[i].buf = (char *) malloc(nr[i].size > 0 ? nr[i].size : 1);
+    nr[i].err = (nr[i].buf == NULL);
+    nr[i].sec = 0;
+#ifdef POSIX_FADV_WILLNEED
+    posix_fadvise(nr[i].fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+  }
+
+  /* A read that cannot get a thread is run here and is over before the
+     others are waited for. */
+
+  nstarted = 0;
+  for (i = 0; i < nnodes; i++) {
+    if (nr[i].fd < 0 || nr[i].err) continue;
+    if (pthread_create(tids+i, NULL, read_node, nr+i) == 0) started[i] = 1;
+    else read_node(nr+i);
+    nstarted++;
+  }
+
+  /* Asks enough() again whenever more reads are over, outside the lock. */
+
+  ok = 0;
+  seen = -1;
+  pthread_mutex_lock(&h.lock);
+  while (1) {
+    if (h.finished == seen) {
+      if (seen == nstarted) break;
+      pthread_cond_wait(&h.cond, &h.lock);
+      continue;
+    }
+    seen = h.finished;
+    for (i = 0; i < nnodes; i++) arrived[i] = (nr[i].fd >= 0 && nr[i].whole);
+    pthread_mutex_unlock(&h.lock);
+    ok = enough(arrived, arg);
+    pthread_mutex_lock(&h.lock);
+    if (ok) break;
+  }
+  h.cancel = 1;
+  pthread_mutex_unlock(&h.lock);
+
+  nread = 0;
+  for (i = 0; i < nnodes; i++) {
+    if (nr[i].fd < 0) continue;
+    if (started[i]) pthread_join(tids[i], NULL);
+    close(nr[i].fd);
+    if (nr[i].err) fprintf(stderr, "Error reading %s\n", fnames[i]);
+    secs[i] = nr[i].sec;
+    if (!nr[i].whole) {
+      free(nr[i].buf);
+      continue;
+    }
+    bufs[i] = nr[i].buf;
+    sizes[i] = nr[i].size;
+    nread++;
+  }
+  pthread_mutex_destroy(&h.lock);
+  pthread_cond_destroy(&h.cond);
+  free(nr);
+  free(tids);
+  free(started);
+  free(arrived);
+  return ok ? nread : -1;
+}
+
+long ml_read_cells(int nnodes, char **fnames, int *reads, ML_Layout *lay, int n, int nb,
+                   char **bufs, long *bytes, double *secs)
+{
+  return ml_read_cols(nnodes, fnames, reads, lay, n, nb, 0, (long) nb*lay->blocksize, bufs, bytes, secs);
+}
+
+long ml_read_cols(int nnodes, char **fnames, int *reads, ML_Layout *lay, int n, int nb, long col,
+                  long width, char **bufs, long *bytes, double *secs)
+{
+  Node_Read *nr;
+  long total;
+  int i, x, rv;
+
+  nr = (Node_Read *) malloc(sizeof(Node_Read)*nnodes);
+  if (nr == NULL) return -1;
+  for (i = 0; i < nnodes; i++) {
+    bytes[i] = 0;
+    secs[i] = 0;
+    nr[i].fd = -1;
+    nr[i].ext = NULL;
+    nr[i].node = -1;
+    nr[i].hedge = NULL;
+    if (reads[i] == 0) continue;
+    nr[i].fd = open(fnames[i], O_RDONLY);
+    if (nr[i].fd < 0) {
+      fprintf(stderr, "Error: cannot open %s\n", fnames[i]);
+      continue;
+    }
+    nr[i].buf = bufs[i];
+    nr[i].err = 0;
+    nr[i].disk = qos_disk(fnames[i], nr[i].fd);
+    nr[i].ext = (Extent *) malloc(sizeof(Extent)*lay->cells*nb);
+    if (nr[i].ext == NULL) {
+      nr[i].err = 1;
+      continue;
+    }
+    nr[i].next = cell_extents(lay, reads[i], n, nb, col, width, bufs[i], nr[i].ext);
+#ifdef POSIX_FADV_WILLNEED
+    for (x = 0; x < nr[i].next; x++) {
+      posix_fadvise(nr[i].fd, nr[i].ext[x].off, nr[i].ext[x].len, POSIX_FADV_WILLNEED);
+    }
+#endif
+  }
+
+  rv = run_reads(nr, nnodes, fnames);
+  total = 0;
+  for (i = 0; i < nnodes; i++) {
+    free(nr[i].ext);
+    if (reads[i] == 0) continue;
+    if (nr[i].fd < 0) rv = -1;
+    if (nr[i].fd < 0 || nr[i].err) continue;
+    bytes[i] = nr[i].bytes;
+    secs[i] = nr[i].sec;
+    total += nr[i].bytes;
+  }
+  free(nr);
+  return (rv < 0) ? -1 : total;
+}
+
+void ml_print_read_times(FILE *f, int nnodes, char **fnames, long *sizes, double *secs)
+{
+  int i, slowest;
+
+  slowest = -1;
+  for (i = 0; i < nnodes; i++) {
+    if (sizes[i] < 0) continue;
+    if (slowest < 0 || secs[i] > secs[slowest]) slowest = i;
+  }
+  for (i = 0; i < nnodes; i++) {
+    if (sizes[i] < 0) {
+      fprintf(f, "Read node %2d: missing      %s\n", i, fnames[i]);
+    } else {
+      fprintf(f, "Read node %2d: %.10f sec  %ld bytes  %s%s\n", i, secs[i], sizes[i], fnames[i],
+              (i == slowest) ? "  (slowest)" : "");
+    }
+  }
+}
+
+int ml_writer_open(ML_Writer *wr, char *fname, long origsize)
+{
+  wr->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (wr->fd < 0) {
+    fprintf(stderr, "Error: cannot create %s\n", fname);
+    return -1;
+  }
+  wr->keep = 0;
+  wr->mem = NULL;
+  wr->off = 0;
+  wr->origsize = origsize;
+  wr->tmp = NULL;
+  return 0;
+}
+
+int ml_writer_open_temp(ML_Writer *wr, char *fname, long origsize)
+{
+  wr->tmp = (char *) malloc(strlen(fname)+8);
+  wr->dst = strdup(fname);
+  if (wr->tmp == NULL || wr->dst == NULL) {
+    free(wr->tmp);
+    free(wr->dst);
+    wr->fd = -1;
+    return -1;
+  }
+  sprintf(wr->tmp, "%s.XXXXXX", fname);
+  wr->fd = mkstemp(wr->tmp);
+  if (wr->fd < 0) {
+    fprintf(stderr, "Error: cannot create a temporary file for %s\n", fname);
+    free(wr->tmp);
+    free(wr->dst);
+    return -1;
+  }
+  fchmod(wr->fd, 0644);
+  wr->keep = 0;
+  wr->mem = NULL;
+  wr->off = 0;
+  wr->origsize = origsize;
+  return 0;
+}
+
+int ml_writer_open_partial(ML_Writer *wr, char *fname, long origsize)
+{
+  wr->tmp = (char *) malloc(strlen(fname)+16);
+  wr->dst = strdup(fname);
+  if (wr->tmp == NULL || wr->dst == NULL) {
+    free(wr->tmp);
+    free(wr->dst);
+    wr->fd = -1;
+    return -1;
+  }
+  sprintf(wr->tmp, "%s.partial", fname);
+  wr->fd = open(wr->tmp, O_RDWR | O_CREAT, 0644);
+  if (wr->fd < 0) {
+    fprintf(stderr, "Error: cannot open %s\n", wr->tmp);
+    free(wr->tmp);
+    free(wr->dst);
+    return -1;
+  }
+  wr->keep = 0;
+  wr->mem = NULL;
+  wr->off = 0;
+  wr->origsize = origsize;
+  return 0;
+}
+
+int ml_writer_open_mem(ML_Writer *wr, char *mem, long origsize)
+{
+  wr->fd = -1;
+  wr->keep = 0;
+  wr->mem = mem;
+  wr->off = 0;
+  wr->origsize = origsize;
+  wr->tmp = NULL;
+  return 0;
+}
+
+int ml_writer_open_memfd(ML_Writer *wr, char *name, long origsize)
+{
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  wr->fd = memfd_create(name, MFD_CLOEXEC);
+  if (wr->fd < 0) return -1;
+  wr->keep = 1;
+  wr->mem = NULL;
+  wr->off = 0;
+  wr->origsize = origsize;
+  wr->tmp = NULL;
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/* Writes nsubs buffers of size bytes each.  Memory output stops at origsize;
+   file output writes everything and leaves the tail to ml_writer_close(). */
+
+int ml_write_subs(ML_Writer *wr, char **subs, int nsubs, long size)
+{
+  struct iovec iov[64];
+  struct iovec *v;
+  long len;
+  ssize_t got;
+  int i, nv;
+
+  if (nsubs > 64) return -1;
+  if (wr->fd < 0) {
+    for (i = 0; i < nsubs && wr->off < wr->origsize; i++) {
+      len = (wr->off+size <= wr->origsize) ? size : wr->origsize-wr->off;
+      memcpy(wr->mem + wr->off, subs[i], len);
+      wr->off += size;
+    }
+    return 0;
+  }
+
+  for (i = 0; i < nsubs; i++) {
+    iov[i].iov_base = subs[i];
+    iov[i].iov_len = size;
+  }
+  v = iov;
+  nv = nsubs;
+  while (nv > 0) {
+    got = pwritev(wr->fd, v, nv, wr->off);
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0) {
+      fprintf(stderr, "Error writing decoded output: %s\n", strerror(errno));
+      return -1;
+    }
+    wr->off += got;
+    while (nv > 0 && (size_t) got >= v->iov_len) {
+      got -= v->iov_len;
+      v++;
+      nv--;
+    }
+    if (nv > 0) {
+      v->iov_base = (char *) v->iov_base + got;
+      v->iov_len -= got;
+    }
+  }
+  return 0;
+}
+
+int ml_write_cells(ML_Writer *wr, ML_Layout *lay, int mask, int n, int nb, char *buf)
+{
+  return ml_write_cols(wr, lay, mask, n, nb, 0, (long) nb*lay->blocksize, buf);
+}
+
+int ml_write_cols(ML_Writer *wr, ML_Layout *lay, int mask, int n, int nb, long col, long width,
+                  char *buf)
+{
+  Extent *ext;
+  ssize_t got;
+  long done, len;
+  int x, next, disk, rv;
+
+  ext = (Extent *) malloc(sizeof(Extent)*lay->cells*nb);
+  if (ext == NULL) return -1;
+  next = cell_extents(lay, mask, n, nb, col, width, buf, ext);
+  disk = (wr->fd >= 0) ? qos_disk((wr->tmp != NULL) ? wr->tmp : wr->dst, wr->fd) : -1;
+  rv = 0;
+  for (x = 0; x < next && rv == 0; x++) {
+    if (wr->fd < 0) {
+      if (ext[x].off >= wr->origsize) continue;
+      len = (ext[x].off+ext[x].len <= wr->origsize) ? ext[x].len : wr->origsize-ext[x].off;
+      memcpy(wr->mem + ext[x].off, ext[x].buf, len);
+      continue;
+    }
+    qos_take(disk, ext[x].len);
+    for (done = 0; done < ext[x].len; done += got) {
+      got = pwrite(wr->fd, ext[x].buf+done, ext[x].len-done, ext[x].off+done);
+      if (got < 0 && errno == EINTR) {
+        got = 0;
+        continue;
+      }
+      if (got <= 0) {
+        fprintf(stderr, "Error writing node file: %s\n", strerror(errno));
+        rv = -1;
+        break;
+      }
+    }
+  }
+  free(ext);
+  return rv;
+}
+
+int ml_writer_close(ML_Writer *wr)
+{
+  int rv;
+
+  if (wr->fd < 0) return 0;
+  rv = 0;
+  if (ftruncate(wr->fd, wr->origsize) < 0) rv = -1;
+  if (wr->tmp != NULL && fsync(wr->fd) < 0) rv = -1;
+  if (!wr->keep) {
+    if (close(wr->fd) < 0) rv = -1;
+    wr->fd = -1;
+  }
+  if (wr->tmp != NULL) {
+    if (rv == 0 && rename(wr->tmp, wr->dst) < 0) rv = -1;
+    if (rv < 0) unlink(wr->tmp);
+    free(wr->tmp);
+    free(wr->dst);
+    wr->tmp = NULL;
+  }
+  return rv;
+}
+
+void ml_writer_abort(ML_Writer *wr)
+{
+  if (wr->fd >= 0 && !wr->keep) {
+    close(wr->fd);
+    wr->fd = -1;
+  }
+  if (wr->tmp != NULL) {
+    unlink(wr->tmp);
+    free(wr->tmp);
+    free(wr->dst);
+    wr->tmp = NULL;
+  }
+}
+
+void ml_writer_suspend(ML_Writer *wr)
+{
+  if (wr->fd >= 0 && !wr->keep) {
+    close(wr->fd);
+    wr->fd = -1;
+  }
+  if (wr->tmp != NULL) {
+    free(wr->tmp);
+    free(wr->dst);
+    wr->tmp = NULL;
+  }
+}
+
+int ml_find_failed(int nnodes, char **fnames, int *failed)
+{
+  struct stat status;
+  int i, n;
+
+  n = 0;
+  for (i = 0; i < nnodes; i++) {
+    failed[i] = (stat(fnames[i], &status) != 0);
+    n += failed[i];
+  }
+  return n;
+}
+
+int ml_object_open(char *path, char **fnames, int *readins, int *layout, long *origsize)
+{
+  FILE *fp;
+  char curdir[1000], tech[64], *base, *ext, *fname;
+  int k, m, w, packetsize, buffersize, technum, n, lay, i, md, rv;
+  long size;
+
+  if (getcwd(curdir, sizeof(curdir)) == NULL) {
+    fprintf(stderr, "Cannot get the current directory\n");
+    return -1;
+  }
+  base = strrchr(path, '/');
+  base = strdup(base != NULL ? base+1 : path);
+  ext = (base != NULL) ? strchr(base, '.') : NULL;
+  ext = strdup(ext != NULL ? ext : "");
+  fname = (char *) malloc(strlen(curdir)+strlen(path)+30);
+  if (base == NULL || ext == NULL || fname == NULL) {
+    free(base);
+    free(ext);
+    free(fname);
+    return -1;
+  }
+  if (*ext != '\0') *strchr(base, '.') = '\0';
+
+  rv = -1;
+  sprintf(fname, "%s/Coding/%s_meta.txt", curdir, base);
+  fp = fopen(fname, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "Error: no metadata file %s\n", fname);
+    goto done;
+  }
+  if (fscanf(fp, "%*s %ld", &size) != 1 ||
+      fscanf(fp, "%d %d %d %d %d", &k, &m, &w, &packetsize, &buffersize) != 5 ||
+      fscanf(fp, "%63s %d", tech, &technum) != 2 || fscanf(fp, "%d", &n) != 1 ||
+      (lay = ml_layout_scan(fp)) < 0) {
+    fprintf(stderr, "Metadata file %s - bad format\n", fname);
+    fclose(fp);
+    goto done;
+  }
+  fclose(fp);
+  if (ml_check_params(k, m, w) < 0) goto done;
+
+  md = snprintf(NULL, 0, "%d", k);
+  for (i = 0; i < ML_NODES; i++) {
+    fnames[i] = (char *) malloc(strlen(curdir)+strlen(path)+30);
+    if (i < k) sprintf(fnames[i], "%s/Coding/%s_k%0*d%s", curdir, base, md, i, ext);
+    else sprintf(fnames[i], "%s/Coding/%s_m%0*d%s", curdir, base, md, i-k, ext);
+  }
+  if (readins != NULL) *readins = n;
+  if (layout != NULL) *layout = lay;
+  if (origsize != NULL) *origsize = size;
+  rv = 0;
+
+done:
+  free(base);
+  free(ext);
+  free(fname);
+  return rv;
+}
+
+void ml_object_free(char **fnames)
+{
+  int i;
+
+  for (i = 0; i < ML_NODES; i++) free(fnames[i]);
+}
+
+int ml_qos_open(char *control)
+{
+  if (control == NULL || *control == '\0') return 0;
+  pthread_mutex_lock(&qos.lock);
+  if (!qos.on) {
+    qos.control = strdup(control);
+    qos.interval = ML_QOS_PROBE;
+    qos.on = (qos.control != NULL);
+    if (qos.on) qos_reload(qos_now());
+    if (qos.mtime == 0) fprintf(stderr, "Warning: no I/O control file %s yet\n", control);
+  }
+  pthread_mutex_unlock(&qos.lock);
+  return qos.on ? 0 : -1;
+}
+
+void ml_qos_report(FILE *f)
+{
+  int x, slowed;
+
+  if (!qos.on) return;
+  pthread_mutex_lock(&qos.lock);
+  slowed = 0;
+  for (x = 0; x < qos.ndisks; x++) slowed += (qos.disks[x].scale < 1);
+  fprintf(f, "I/O throttle: %.3f sec waited over all threads, %d backoffs, %d of %d disks backed off\n",
+          qos.waited, qos.backoffs, slowed, qos.ndisks);
+  pthread_mutex_unlock(&qos.lock);
+}
@@ -0,0 +1,194 @@
+/* ml_io.h
+ * Node file I/O shared by decoder.c and the repair programs.
+ */
+
+#ifndef _ML_IO_H
+#define _ML_IO_H
+
+#include <stdio.h>
+
+/* Reads the node files of a stripe concurrently.  fnames[i] names the file
+   of node i.  Every file that opens is announced to the kernel with
+   POSIX_FADV_WILLNEED and then read whole by its own thread into bufs[i]
+   (malloc'd), with its length in sizes[i] and its read time in seconds in
+   secs[i].  Files that do not open get bufs[i] = NULL and sizes[i] = -1.
+   Returns the number of files read, or -1 if a present file could not be
+   read. */
+
+int ml_read_nodes(int nnodes, char **fnames, char **bufs, long *sizes, double *secs);
+
+/* Hedged reads: ml_read_nodes() of the files flagged in want[] only, that
+   returns as soon as the files read so far are enough.  Each time a file
+   has been read, enough() is called with arrived[i] set for every file read
+   whole; once it returns nonzero the reads still running are cancelled
+   (they stop within ML_HEDGE_CHUNK bytes) and their files come back as if
+   missing, bufs[i] = NULL and sizes[i] = -1, with the time they ran in
+   secs[i].  A file that cannot be read is only left out.  Returns the
+   number of files read, or -1 if they were never enough. */
+
+#define ML_HEDGE_CHUNK (1 << 20)
+
+int ml_read_first(int nnodes, char **fnames, int *want, int (*enough)(int *arrived, void *arg),
+                  void *arg, char **bufs, long *sizes, double *secs);
+
+/* A slow disk simulator for trying the above.  The environment variable
+   ML_IO_DELAY holds comma-separated items node:ms[:p], node a number or *
+   for any: each read of ml_read_nodes() or ml_read_first() of that node
+   waits ms milliseconds first, with probability p (1 if not given).  For
+   instance "3:200" makes node 3 a slow disk and "*:50:0.05" gives every
+   read a 5% chance of a 50 ms stall.  A cancelled read stops waiting. */
+
+#define ML_IO_DELAY "ML_IO_DELAY"
+#define ML_IO_DELAYS 32
+
+/* Flags in failed[] the node files that do not exist; returns how many. */
+
+int ml_find_failed(int nnodes, char **fnames, int *failed);
+
+/* Files encoded by encoder.c.  ml_object_open() reads the metadata of path
+   from Coding/<base>_meta.txt under the current directory, base being the
+   file name of path up to its first '.', and checks it is of the
+   multilayer code.  fnames[] gets the names of the ML_NODES node files,
+   Coding/<base>_k<i><ext> and Coding/<base>_m<i><ext> with ext the rest of
+   the file name, for ml_object_free() to free.  readins, layout and
+   origsize get those of the metadata; any of them may be NULL.  Returns 0,
+   or -1 with a message on stderr. */
+
+int ml_object_open(char *path, char **fnames, int *readins, int *layout, long *origsize);
+void ml_object_free(char **fnames);
+
+/* Node file layouts, named on the line after readins in the metadata file
+   (natural if there is none).  A node file holds cells cells of blocksize
+   bytes for each of readins read-ins.  The natural layout stores read-in
+   after read-in, its cells in order; the grouped layout stores cell after
+   cell, that cell of every read-in in order.  A repair reads the same cells
+   of every read-in, which grouped puts in a few long extents.  With one
+   read-in both layouts are the same. */
+
+#define ML_LAYOUT_NATURAL 0
+#define ML_LAYOUT_GROUPED 1
+#define ML_LAYOUTS 2
+
+typedef struct {
+  int layout;
+  int readins;
+  int cells;
+  int blocksize;
+} ML_Layout;
+
+extern char *ml_layout_names[ML_LAYOUTS];
+
+/* Returns the layout of the given name, or -1.  ml_layout_scan() reads the
+   optional layout line of a metadata file. */
+
+int ml_layout_parse(char *name);
+int ml_layout_scan(FILE *fp);
+
+/* Offset in the node file of cell t of read-in n. */
+
+long ml_layout_offset(ML_Layout *lay, int n, int t);
+
+/* Reads selected cells of the node files concurrently, one thread per node:
+   bit t of reads[i] asks for cell t of node i, for the nb read-ins from n
+   on.  Cell t of read-in n+j lands at bufs[i] + (t*nb+j)*blocksize, so the
+   buffer holds cells of nb*blocksize bytes.  Cells adjacent in the file
+   and in the buffer go in one pread().  Nodes with reads[i] == 0 are not
+   opened.  bytes[i] and secs[i] get what was read from each node and how
+   long it took.  Returns the total number of bytes read, or -1 on an
+   error. */
+
+#define ML_IO_CELLS 32          /* Cells per read-in a read mask can address */
+
+long ml_read_cells(int nnodes, char **fnames, int *reads, ML_Layout *lay, int n, int nb,
+                   char **bufs, long *bytes, double *secs);
+
+/* The same for a window of columns: the nb read-ins of a cell are taken as
+   one cell of nb*blocksize bytes, and only its bytes [col, col+width) are
+   read, cell t to bufs[i] + t*width.  Repairs work column by column, so a
+   window can be repaired on its own in buffers of a fixed size. */
+
+long ml_read_cols(int nnodes, char **fnames, int *reads, ML_Layout *lay, int n, int nb, long col,
+                  long width, char **bufs, long *bytes, double *secs);
+
+/* Prints one line per node read by ml_read_nodes(), slowest node flagged. */
+
+void ml_print_read_times(FILE *f, int nnodes, char **fnames, long *sizes, double *secs);
+
+/* Output stage for decoded files.  The file stays open across read-ins,
+   each read-in's sub-stripes go out in one pwritev() at the running offset,
+   and ml_writer_close() cuts the padding off with ftruncate().  The output
+   can instead go to a caller-provided buffer of at least origsize bytes, or
+   to an anonymous memfd that is left open in wr->fd for the caller.
+
+   ml_writer_open_temp() writes to a temporary file next to fname, which
+   ml_writer_close() syncs and renames over fname, so fname only ever
+   appears complete.  ml_writer_abort() removes it instead.
+   ml_writer_open_partial() does the same with the fixed name
+   fname.partial, opened without truncating it, so a write that was cut
+   short can be taken up again; ml_writer_suspend() closes it and leaves it
+   there. */
+
+typedef struct {
+  int fd;                       /* -1 when writing into mem */
+  int keep;                     /* Leave fd open on close (memfd) */
+  char *mem;
+  long off;                     /* Padded bytes written so far */
+  long origsize;
+  char *tmp;                    /* Temporary file renamed to dst on close, or NULL */
+  char *dst;
+} ML_Writer;
+
+int ml_writer_open(ML_Writer *wr, char *fname, long origsize);
+int ml_writer_open_temp(ML_Writer *wr, char *fname, long origsize);
+int ml_writer_open_partial(ML_Writer *wr, char *fname, long origsize);
+int ml_writer_open_mem(ML_Writer *wr, char *mem, long origsize);
+int ml_writer_open_memfd(ML_Writer *wr, char *name, long origsize);
+int ml_write_subs(ML_Writer *wr, char **subs, int nsubs, long size);
+
+/* Writes a node file from a buffer laid out as for ml_read_cells(), the
+   cells in mask of the nb read-ins from n on, each at its place in the
+   file; ml_write_cols() from one laid out as for ml_read_cols(). */
+
+int ml_write_cells(ML_Writer *wr, ML_Layout *lay, int mask, int n, int nb, char *buf);
+int ml_write_cols(ML_Writer *wr, ML_Layout *lay, int mask, int n, int nb, long col, long width,
+                  char *buf);
+int ml_writer_close(ML_Writer *wr);
+void ml_writer_abort(ML_Writer *wr);
+void ml_writer_suspend(ML_Writer *wr);
+
+/* Throttling of repair I/O, so a repair leaves the disks to foreground
+   reads.  Once ml_qos_open() has been called with the name of a control
+   file, every pread() and pwrite() of node files in this process first
+   takes its bytes and one I/O from token buckets: a global one and one per
+   disk (device) the file is on.  The control file holds lines of
+
+     rate <bytes/s>               all disks together; K, M or G may follow
+     iops <n>
+     disk <path>|* <bytes/s> [<iops>]   the disk holding path, or any other
+     latency <ms> [<probe ms>]    back off above this read latency
+     observed <file>              foreground latencies, lines of <path>|* <ms>
+
+   where 0 or a missing line is no limit, and is read again whenever it
+   changes, so limits can be moved while a repair runs.  With latency set,
+   the read latency of each disk is looked at every probe ms (ML_QOS_PROBE
+   by default).  It is taken from the observed file, which whatever serves
+   the foreground reads keeps up to date, for the disks it names.  Other
+   disks are probed: a 4 KB read of a random block of a file on the disk is
+   timed, past the page cache where the system allows.  A probe only stands
+   for the foreground reads, one read every probe ms, and is itself an I/O
+   on the disk.  When the latency is over latency ms the limits of that
+   disk are halved, down to ML_QOS_MIN_RATE and ML_QOS_MIN_IOPS so the
+   repair still moves, and each look under it gives back a sixteenth.
+   ml_qos_open() with NULL or "" leaves I/O unthrottled; ml_qos_report()
+   prints the time spent waiting and the backoffs. */
+
+#define ML_QOS_DISKS 64
+#define ML_QOS_PROBE 0.1        /* Seconds */
+#define ML_QOS_RELOAD 0.5       /* Seconds between looks at the control file */
+#define ML_QOS_MIN_RATE (256 << 10)
+#define ML_QOS_MIN_IOPS 16
+
+int ml_qos_open(char *control);
+void ml_qos_report(FILE *f);
+
+#endif
@@ -0,0 +1,625 @@
+/* ml_net.c
+ * Helper and repairer processes of a repair.  See ml_net.h.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "jerasure.h"
+#include "galois.h"
+#include "timing.h"
+#include "multilayer.h"
+#include "ml_io.h"
+#include "ml_repair.h"
+#include "ml_net.h"
+
+/* Star: helper i sends nrows cells per batch, row s the sum over t of
+   rows[s*ML_SUBS+t] times its cell t, and the repairer adds coef[q*nrows+s]
+   times row s into lost cell q.  Chain: helper i adds coef[q*ML_SUBS+t]
+   times its cell t into lost cell q of each slice it passes on. */
+
+typedef struct {
+  int node;
+  int mask;                     /* Cells read */
+  int nrows;
+  int rows[ML_SUBS*ML_SUBS];
+  int *coef;
+  int fd;                       /* Star: repairer's end of the socket */
+  pid_t pid;
+  char *buf;                    /* Star: the rows of one batch as received */
+  long read;
+  long sent;
+} Helper;
+
+typedef struct {
+  int n;                        /* First read-in of the batch, -1 to stop */
+  int nb;
+} Request;
+
+/* What both modes share: the joint plan (inverse for one failure), the
+   node file layout and the buffers and writers of the failed nodes. */
+
+typedef struct {
+  ML_Repair rp;
+  ML_Layout lay;
+  ML_Writer out[ML_NODES];
+  char *nodes[ML_NODES];
+  int *failed;
+  char **fnames;
+  int batch;
+} Net_Repair;
+
+/* Link pacing.  Every process counts the bytes it receives and sends and
+   sleeps whenever either count runs ahead of net_rate bytes per second, as
+   a NIC of that speed would make it wait. */
+
+typedef struct {
+  struct timing start;
+  long bytes;
+} Pace;
+
+static double net_rate;
+static Pace pace_in, pace_out;
+
+static void pace_reset(double rate)
+{
+  net_rate = rate;
+  pace_in.bytes = -1;
+  pace_out.bytes = -1;
+}
+
+static void pace(Pace *p, long n)
+{
+  struct timing now;
+  double ahead;
+
+  if (net_rate <= 0) return;
+  if (p->bytes < 0) {
+    timing_set(&p->start);
+    p->bytes = 0;
+  }
+  p->bytes += n;
+  timing_set(&now);
+  ahead = p->bytes/net_rate - timing_delta(&p->start, &now);
+  if (ahead > 0) usleep((useconds_t) (ahead*1e6));
+}
+
+static int sock_write(int fd, char *buf, long len)
+{
+  ssize_t got;
+  long done;
+
+  for (done = 0; done < len; done += got) {
+    got = send(fd, buf+done, len-done, MSG_NOSIGNAL);
+    if (got < 0 && errno == EINTR) {
+      got = 0;
+      continue;
+    }
+    if (got <= 0) return -1;
+  }
+  pace(&pace_out, len);
+  return 0;
+}
+
+static int sock_read(int fd, char *buf, long len)
+{
+  ssize_t got;
+  long done;
+
+  for (done = 0; done < len; done += got) {
+    got = read(fd, buf+done, len-done);
+    if (got < 0 && errno == EINTR) {
+      got = 0;
+      continue;
+    }
+    if (got <= 0) return -1;
+  }
+  pace(&pace_in, len);
+  return 0;
+}
+
+static int ncells(int mask)
+{
+  int t, n;
+
+  n = 0;
+  for (t = 0; t < ML_SUBS; t++) n += (mask >> t) & 1;
+  return n;
+}
+
+/* The nlost x ML_SUBS coefficients of the cells of helper h in the combine
+   ops of plan. */
+
+static int *helper_coefs(Helper *h, ML_Plan *plan)
+{
+  int *c;
+  int q, t;
+
+  c = talloc(int, plan->nops*ML_SUBS);
+  if (c == NULL) return NULL;
+  for (q = 0; q < plan->nops; q++) {
+    for (t = 0; t < ML_SUBS; t++) {
+      c[q*ML_SUBS+t] = ((h->mask >> t) & 1) ? plan->ops[q].dm[ML_CELL(t, h->node)] : 0;
+    }
+  }
+  return c;
+}
+
+/* Splits the combine ops of plan for helper h.  Its coefficients form an
+   nlost x ML_SUBS matrix C.  The nonzero rows of the reduced echelon form
+   of C span its rows and hold a unit at their pivot column, so row q of C
+   is the sum over s of C[q][pivot s] times row s.  Those rows are what the
+   helper sends when combining and there are fewer of them than its cells;
+   otherwise it sends the cells themselves, which are rows too. */
+
+static int split_helper(Helper *h, ML_Plan *plan, int combine)
+{
+  int *c, *e;
+  int pivot[ML_SUBS];
+  int nl, q, r, p, t, x, f, inv;
+
+  nl = plan->nops;
+  c = helper_coefs(h, plan);
+  e = talloc(int, nl*ML_SUBS);
+  h->coef = talloc(int, nl*ML_SUBS);
+  if (c == NULL || e == NULL || h->coef == NULL) {
+    free(c);
+    free(e);
+    free(h->coef);
+    h->coef = NULL;
+    return -1;
+  }
+  memcpy(e, c, sizeof(int)*nl*ML_SUBS);
+
+  r = 0;
+  for (t = 0; t < ML_SUBS && r < nl; t++) {
+    for (p = r; p < nl && e[p*ML_SUBS+t] == 0; p++) ;
+    if (p == nl) continue;
+    for (x = 0; x < ML_SUBS; x++) {
+      f = e[p*ML_SUBS+x];
+      e[p*ML_SUBS+x] = e[r*ML_SUBS+x];
+      e[r*ML_SUBS+x] = f;
+    }
+    inv = galois_single_divide(1, e[r*ML_SUBS+t], ML_W);
+    for (x = 0; x < ML_SUBS; x++) e[r*ML_SUBS+x] = galois_single_multiply(e[r*ML_SUBS+x], inv, ML_W);
+    for (q = 0; q < nl; q++) {
+      f = e[q*ML_SUBS+t];
+      if (q == r || f == 0) continue;
+      for (x = 0; x < ML_SUBS; x++) e[q*ML_SUBS+x] ^= galois_single_multiply(f, e[r*ML_SUBS+x], ML_W);
+    }
+    pivot[r++] = t;
+  }
+
+  if (combine && r < ncells(h->mask)) {
+    h->nrows = r;
+    memcpy(h->rows, e, sizeof(int)*r*ML_SUBS);
+  } else {
+    h->nrows = 0;
+    memset(h->rows, 0, sizeof(h->rows));
+    for (t = 0; t < ML_SUBS; t++) {
+      if (!((h->mask >> t) & 1)) continue;
+      h->rows[h->nrows*ML_SUBS+t] = 1;
+      pivot[h->nrows++] = t;
+    }
+  }
+  for (q = 0; q < nl; q++) {
+    for (r = 0; r < h->nrows; r++) h->coef[q*h->nrows+r] = c[q*ML_SUBS+pivot[r]];
+  }
+  free(c);
+  free(e);
+  return 0;
+}
+
+/* dst = (add ? dst : 0) + sum over t of coef[t] times cell t, the cells
+   stride bytes apart. */
+
+static void combine_cells(char *dst, char *cells, long stride, int *coef, long len, int add)
+{
+  int t;
+
+  for (t = 0; t < ML_SUBS; t++) {
+    if (coef[t] == 0) continue;
+    galois_w08_region_multiply(cells + t*stride, coef[t], len, dst, add);
+    add = 1;
+  }
+  if (!add) memset(dst, 0, len);
+}
+
+static int net_close(Net_Repair *nr, int rv)
+{
+  int i;
+
+  for (i = 0; i < ML_NODES; i++) {
+    if (nr->failed[i] && nr->out[i].fd >= 0) {
+      if (rv == 0 && ml_writer_close(nr->out+i) < 0) {
+        fprintf(stderr, "Error finishing %s\n", nr->fnames[i]);
+        rv = -1;
+      }
+    }
+  }
+  for (i = 0; i < ML_NODES; i++) {
+    if (rv < 0 && nr->out[i].fd >= 0) ml_writer_abort(nr->out+i);
+    free(nr->nodes[i]);
+  }
+  ml_repair_free(&nr->rp);
+  return rv;
+}
+
+static int net_open(Net_Repair *nr, int *matrix, char **fnames, int *failed, int readins, int layout)
+{
+  struct stat status;
+  int load[ML_NODES];
+  int *lp;
+  int i, blocksize;
+
+  blocksize = -1;
+  for (i = 0; i < ML_NODES && blocksize < 0; i++) {
+    if (!failed[i] && stat(fnames[i], &status) == 0) blocksize = status.st_size/(ML_SUBS*readins);
+  }
+  if (blocksize < 0) return -1;
+  ml_qos_open(getenv(ML_REPAIR_QOS));
+  lp = (ml_repair_loads(failed, load) > 0) ? load : NULL;
+  if (ml_repair_plan(&nr->rp, ML_REPAIR_JOINT, matrix, failed, lp, getenv(ML_REPAIR_CACHE), NULL) < 0 &&
+      ml_repair_plan(&nr->rp, ML_REPAIR_INVERSE, matrix, failed, lp, getenv(ML_REPAIR_CACHE), NULL) < 0) {
+    fprintf(stderr, "These nodes cannot be repaired\n");
+    return -1;
+  }
+  nr->failed = failed;
+  nr->fnames = fnames;
+  nr->lay.layout = layout;
+  nr->lay.readins = readins;
+  nr->lay.cells = ML_SUBS;
+  nr->lay.blocksize = blocksize;
+  nr->batch = 1;
+  if (layout == ML_LAYOUT_GROUPED) {
+    nr->batch = ML_REPAIR_EXTENT/blocksize;
+    if (nr->batch < 1) nr->batch = 1;
+    if (nr->batch > readins) nr->batch = readins;
+  }
+
+  for (i = 0; i < ML_NODES; i++) {
+    nr->nodes[i] = NULL;
+    nr->out[i].fd = -1;
+  }
+  for (i = 0; i < ML_NODES; i++) {
+    if (!failed[i]) continue;
+    nr->nodes[i] = (char *) malloc(sizeof(char)*ML_SUBS*nr->batch*blocksize);
+    if (nr->nodes[i] == NULL ||
+        ml_writer_open_temp(nr->out+i, fnames[i], (long) readins*ML_SUBS*blocksize) < 0) {
+      return net_close(nr, -1);
+    }
+  }
+  return 0;
+}
+
+static int net_write(Net_Repair *nr, int n, int nb)
+{
+  int i;
+
+  for (i = 0; i < ML_NODES; i++) {
+    if (nr->failed[i] && ml_write_cells(nr->out+i, &nr->lay, (1 << ML_SUBS)-1, n, nb, nr->nodes[i]) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Lost cell q of the current batch, cells of size bytes. */
+
+static char *lost_cell(Net_Repair *nr, int q, long size)
+{
+  int c;
+
+  c = nr->rp.plan.ops[q].dst;
+  return nr->nodes[ML_CELL_NODE(c)] + ML_CELL_SUB(c)*size;
+}
+
+/* The star helper process: for each request, pread the cells of the batch
+   and send back the rows. */
+
+static int serve(Helper *h, int fd, char *fname, ML_Layout *lay, int batch)
+{
+  Request rq;
+  char *cells, *out;
+  long size, bytes;
+  double sec;
+  int s;
+
+  size = (long) batch*lay->blocksize;
+  cells = (char *) malloc(sizeof(char)*ML_SUBS*size);
+  out = (char *) malloc(sizeof(char)*(h->nrows > 0 ? h->nrows : 1)*size);
+  if (cells == NULL || out == NULL) return -1;
+
+  while (sock_read(fd, (char *) &rq, sizeof(rq)) == 0 && rq.n >= 0) {
+    size = (long) rq.nb*lay->blocksize;
+    if (ml_read_cells(1, &fname, &h->mask, lay, rq.n, rq.nb, &cells, &bytes, &sec) < 0) return -1;
+    for (s = 0; s < h->nrows; s++) combine_cells(out + s*size, cells, size, h->rows + s*ML_SUBS, size, 0);
+    if (sock_write(fd, out, h->nrows*size) < 0) return -1;
+  }
+  free(cells);
+  free(out);
+  return 0;
+}
+
+/* Starts helper j of hp.  The child closes the sockets of helpers 0..j-1
+   it inherits, so that each helper sees EOF as soon as the repairer closes
+   its end. */
+
+static int start_helper(Helper *hp, int j, char *fname, ML_Layout *lay, int batch)
+{
+  Helper *h;
+  int sv[2], x;
+
+  h = hp+j;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) return -1;
+  fflush(NULL);
+  h->pid = fork();
+  if (h->pid < 0) {
+    close(sv[0]);
+    close(sv[1]);
+    return -1;
+  }
+  if (h->pid == 0) {
+    close(sv[0]);
+    for (x = 0; x < j; x++) close(hp[x].fd);
+    pace_reset(net_rate);
+    _exit(serve(h, sv[1], fname, lay, batch) < 0);
+  }
+  close(sv[1]);
+  h->fd = sv[0];
+  return 0;
+}
+
+static int wait_helper(Helper *h)
+{
+  int status;
+
+  if (h->pid <= 0) return 0;
+  if (waitpid(h->pid, &status, 0) < 0) return -1;
+  h->pid = 0;
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+static int stop_helper(Helper *h)
+{
+  Request rq;
+
+  if (h->pid <= 0) return 0;
+  rq.n = -1;
+  rq.nb = 0;
+  sock_write(h->fd, (char *) &rq, sizeof(rq));
+  close(h->fd);
+  return wait_helper(h);
+}
+
+static void init_helpers(Helper *hp, int *nh, ML_Repair *rp)
+{
+  int i;
+
+  *nh = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    if (rp->reads[i] == 0) continue;
+    hp[*nh].node = i;
+    hp[*nh].mask = rp->reads[i];
+    hp[*nh].coef = NULL;
+    hp[*nh].fd = -1;
+    hp[*nh].pid = 0;
+    hp[*nh].buf = NULL;
+    hp[*nh].read = 0;
+    hp[*nh].sent = 0;
+    (*nh)++;
+  }
+}
+
+int ml_net_repair(int *matrix, char **fnames, int *failed, int readins, int layout, int combine,
+                  double rate, FILE *report)
+{
+  Net_Repair nr;
+  Helper hp[ML_NODES];
+  Request rq;
+  char *dst;
+  struct timing t1, t2;
+  long size, sent, read;
+  int j, q, s, n, nb, nh, rv;
+
+  if (net_open(&nr, matrix, fnames, failed, readins, layout) < 0) return -1;
+  pace_reset(rate);
+  rv = -1;
+  init_helpers(hp, &nh, &nr.rp);
+  for (j = 0; j < nh; j++) {
+    if (split_helper(hp+j, &nr.rp.plan, combine) < 0) goto done;
+    hp[j].buf = (char *) malloc(sizeof(char)*(hp[j].nrows > 0 ? hp[j].nrows : 1)*nr.batch*nr.lay.blocksize);
+    if (hp[j].buf == NULL) goto done;
+  }
+  for (j = 0; j < nh; j++) {
+    if (start_helper(hp, j, fnames[hp[j].node], &nr.lay, nr.batch) < 0) goto done;
+  }
+
+  /* Ask every helper for a batch before collecting any of them, so they
+     read and combine at the same time. */
+
+  timing_set(&t1);
+  for (n = 0; n < readins; n += nb) {
+    nb = (readins-n < nr.batch) ? readins-n : nr.batch;
+    size = (long) nb*nr.lay.blocksize;
+    rq.n = n;
+    rq.nb = nb;
+    for (j = 0; j < nh; j++) {
+      if (sock_write(hp[j].fd, (char *) &rq, sizeof(rq)) < 0) goto done;
+    }
+    for (j = 0; j < nh; j++) {
+      if (sock_read(hp[j].fd, hp[j].buf, hp[j].nrows*size) < 0) goto done;
+      hp[j].read += ncells(hp[j].mask)*size;
+      hp[j].sent += hp[j].nrows*size;
+    }
+    for (q = 0; q < nr.rp.plan.nops; q++) {
+      dst = lost_cell(&nr, q, size);
+      memset(dst, 0, size);
+      for (j = 0; j < nh; j++) {
+        for (s = 0; s < hp[j].nrows; s++) {
+          if (hp[j].coef[q*hp[j].nrows+s] == 0) continue;
+          galois_w08_region_multiply(hp[j].buf + s*size, hp[j].coef[q*hp[j].nrows+s], size, dst, 1);
+        }
+      }
+    }
+    if (net_write(&nr, n, nb) < 0) goto done;
+  }
+  timing_set(&t2);
+  rv = 0;
+
+  if (report != NULL) {
+    fprintf(report, "Star repair, helpers %s:\n", combine ? "combining" : "sending raw cells");
+    read = 0;
+    sent = 0;
+    for (j = 0; j < nh; j++) {
+      fprintf(report, "Helper node %2d: read %ld bytes, sent %ld bytes in %d cells per read-in\n",
+              hp[j].node, hp[j].read, hp[j].sent, hp[j].nrows);
+      read += hp[j].read;
+      sent += hp[j].sent;
+    }
+    fprintf(report, "Total: read %ld bytes, sent %ld bytes, repairer received %ld bytes\n",
+            read, sent, sent);
+    fprintf(report, "Repair time (sec): %0.10f\n", timing_delta(&t1, &t2));
+  }
+
+done:
+  for (j = 0; j < nh; j++) {
+    if (stop_helper(hp+j) < 0) rv = -1;
+    free(hp[j].coef);
+    free(hp[j].buf);
+  }
+  return net_close(&nr, rv);
+}
+
+/* The chain helper process.  It reads its cells one batch at a time and,
+   for each slice of the batch, takes the partial lost cells from the
+   previous helper (zero for the first), adds its own part and passes them
+   on, so every helper works on a different slice at the same time. */
+
+static int chain_serve(Helper *h, int in, int out, char *fname, Net_Repair *nr, int slice)
+{
+  char *cells, *acc;
+  long size, off, len, bytes;
+  double sec;
+  int n, nb, q, nl;
+
+  nl = nr->rp.plan.nops;
+  cells = (char *) malloc(sizeof(char)*ML_SUBS*nr->batch*nr->lay.blocksize);
+  acc = (char *) malloc(sizeof(char)*nl*slice);
+  if (cells == NULL || acc == NULL) return -1;
+
+  for (n = 0; n < nr->lay.readins; n += nb) {
+    nb = (nr->lay.readins-n < nr->batch) ? nr->lay.readins-n : nr->batch;
+    size = (long) nb*nr->lay.blocksize;
+    if (ml_read_cells(1, &fname, &h->mask, &nr->lay, n, nb, &cells, &bytes, &sec) < 0) return -1;
+    for (off = 0; off < size; off += len) {
+      len = (size-off < slice) ? size-off : slice;
+      if (in >= 0 && sock_read(in, acc, nl*len) < 0) return -1;
+      for (q = 0; q < nl; q++) {
+        combine_cells(acc + q*len, cells + off, size, h->coef + q*ML_SUBS, len, in >= 0);
+      }
+      if (sock_write(out, acc, nl*len) < 0) return -1;
+    }
+  }
+  free(cells);
+  free(acc);
+  return 0;
+}
+
+int ml_chain_repair(int *matrix, char **fnames, int *failed, int readins, int layout, int slice,
+                    double rate, FILE *report)
+{
+  Net_Repair nr;
+  Helper hp[ML_NODES];
+  int link[ML_NODES][2];
+  char *acc;
+  struct timing t1, t2;
+  long size, off, len, total;
+  int i, j, q, n, nb, nh, nl, rv;
+
+  if (net_open(&nr, matrix, fnames, failed, readins, layout) < 0) return -1;
+  pace_reset(rate);
+  rv = -1;
+  acc = NULL;
+  init_helpers(hp, &nh, &nr.rp);
+  for (j = 0; j < nh; j++) link[j][0] = link[j][1] = -1;
+  nl = nr.rp.plan.nops;
+  if (slice <= 0) slice = ML_NET_SLICE;
+  acc = (char *) malloc(sizeof(char)*nl*slice);
+  if (acc == NULL) goto done;
+  for (j = 0; j < nh; j++) {
+    hp[j].coef = helper_coefs(hp+j, &nr.rp.plan);
+    if (hp[j].coef == NULL) goto done;
+  }
+
+  /* Link j runs from helper j to helper j+1, the last one to the
+     repairer.  Each helper keeps only the two ends it uses. */
+
+  for (j = 0; j < nh; j++) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, link[j]) < 0) goto done;
+  }
+  fflush(NULL);
+  for (j = 0; j < nh; j++) {
+    hp[j].pid = fork();
+    if (hp[j].pid < 0) goto done;
+    if (hp[j].pid == 0) {
+      for (i = 0; i < nh; i++) {
+        if (i != j-1) close(link[i][1]);
+        if (i != j) close(link[i][0]);
+      }
+      pace_reset(rate);
+      _exit(chain_serve(hp+j, (j > 0) ? link[j-1][1] : -1, link[j][0], fnames[hp[j].node], &nr, slice) < 0);
+    }
+  }
+  for (j = 0; j < nh; j++) {
+    close(link[j][0]);
+    if (j < nh-1) close(link[j][1]);
+    link[j][0] = -1;
+    if (j < nh-1) link[j][1] = -1;
+  }
+
+  timing_set(&t1);
+  total = 0;
+  for (n = 0; n < readins; n += nb) {
+    nb = (readins-n < nr.batch) ? readins-n : nr.batch;
+    size = (long) nb*nr.lay.blocksize;
+    for (off = 0; off < size; off += len) {
+      len = (size-off < slice) ? size-off : slice;
+      if (sock_read(link[nh-1][1], acc, nl*len) < 0) goto done;
+      total += nl*len;
+      for (q = 0; q < nl; q++) memcpy(lost_cell(&nr, q, size) + off, acc + q*len, len);
+    }
+    if (net_write(&nr, n, nb) < 0) goto done;
+  }
+  timing_set(&t2);
+  rv = 0;
+
+  if (report != NULL) {
+    fprintf(report, "Chain repair, %ld-byte slices:", (long) slice);
+    for (j = 0; j < nh; j++) fprintf(report, " %d ->", hp[j].node);
+    fprintf(report, " repairer\n");
+    fprintf(report, "Every link: %ld bytes, repairer received %ld bytes\n", total, total);
+    fprintf(report, "Repair time (sec): %0.10f\n", timing_delta(&t1, &t2));
+  }
+
+done:
+  for (j = 0; j < nh; j++) {
+    if (link[j][0] >= 0) close(link[j][0]);
+    if (link[j][1] >= 0) close(link[j][1]);
+  }
+  for (j = 0; j < nh; j++) {
+    if (wait_helper(hp+j) < 0) rv = -1;
+    free(hp[j].coef);
+  }
+  free(acc);
+  return net_close(&nr, rv);
+}
@@ -0,0 +1,46 @@
+/* ml_net.h
+ * Repair split between helper processes and the repairer, talking over
+ * Unix-domain sockets.
+ */
+
+#ifndef _ML_NET_H
+#define _ML_NET_H
+
+#include <stdio.h>
+
+/* The repair is the one of the joint strategy (ml_repair.h), or of inverse
+   for a single failure: every lost cell is one combination of the cells
+   read.  That sum splits by helper, so helper i only has to send the span
+   of its own part, the rows of its coefficients restricted to its cells.
+   Each helper runs as a process of its own with one end of a
+   socketpair(AF_UNIX): it preads its cells and, if combine is set, sends
+   one combined cell per independent row (never more than the cells it
+   read), otherwise the raw cells.  The repairer forms the lost cells from
+   what the helpers send and writes the failed node files as
+   ml_repair_files() does.
+
+   The bytes each helper read and sent are printed to report if not NULL.
+   Returns 0, or -1 on an error. */
+
+int ml_net_repair(int *matrix, char **fnames, int *failed, int readins, int layout, int combine,
+                  double rate, FILE *report);
+
+/* Chain repair.  The helpers form a pipeline ending at the repairer instead
+   of a star around it: the first helper sends its scaled cells as partial
+   lost cells, every later one adds its own part and passes them on, and the
+   repairer receives the finished lost cells.  Cells travel in slices of
+   slice bytes (ML_NET_SLICE if 0), so while helper j works on one slice
+   helper j+1 works on the one before, and the repair takes about as long as
+   moving one set of lost cells over one link.  No link, the repairer's
+   included, carries more than that.
+
+   If rate is above 0, every process sends and receives at most rate bytes
+   per second, to stand in for the link speed of a real cluster.  Same
+   report and return value as ml_net_repair(). */
+
+#define ML_NET_SLICE (16 << 10)
+
+int ml_chain_repair(int *matrix, char **fnames, int *failed, int readins, int layout, int slice,
+                    double rate, FILE *report);
+
+#endif
@@ -0,0 +1,1318 @@
+/* ml_repair.c
+ * Repair engine for the multilayer code.  See ml_repair.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "jerasure.h"
+#include "timing.h"
+#include "multilayer.h"
+#include "ml_io.h"
+#include "ml_repair.h"
+
+static int nfailed(int *failed)
+{
+  int i, n;
+
+  n = 0;
+  for (i = 0; i < ML_NODES; i++) n += (failed[i] != 0);
+  return n;
+}
+
+static int single(int *failed)
+{
+  int i;
+
+  if (nfailed(failed) != 1) return -1;
+  for (i = 0; !failed[i]; i++) ;
+  return i;
+}
+
+static void read_all(int *failed, int *reads)
+{
+  int i;
+
+  for (i = 0; i < ML_NODES; i++) reads[i] = failed[i] ? 0 : (1 << ML_SUBS)-1;
+}
+
+/* The nodes in the order their reads are given up: the most loaded first,
+   and the highest numbered first among equals. */
+
+static void drop_order(int *load, int *order)
+{
+  int i, j, x;
+
+  for (i = 0; i < ML_NODES; i++) {
+    x = ML_NODES-1-i;
+    for (j = i; j > 0 && load[order[j-1]] < load[x]; j--) order[j] = order[j-1];
+    order[j] = x;
+  }
+}
+
+static int max_load(int *load, int *reads)
+{
+  int i, hot;
+
+  hot = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    if (reads[i] != 0 && load[i] > hot) hot = load[i];
+  }
+  return hot;
+}
+
+/* A full decode needs only k of the nodes.  Survivors are left unread in
+   drop order, as long as the stripe still decodes without them.  skip[]
+   gets the failed and the unread nodes, reads[] the rest. */
+
+static void read_k(int *matrix, int *failed, int *load, int *skip, int *reads)
+{
+  ML_Plan probe;
+  int order[ML_NODES];
+  int i, x, n;
+
+  for (i = 0; i < ML_NODES; i++) skip[i] = failed[i];
+  drop_order(load, order);
+  n = nfailed(failed);
+  for (x = 0; x < ML_NODES && n < ML_M; x++) {
+    i = order[x];
+    if (skip[i]) continue;
+    skip[i] = 1;
+    if (ml_plan_decode(&probe, matrix, skip) < 0) {
+      skip[i] = 0;
+      continue;
+    }
+    ml_plan_free(&probe);
+    n++;
+  }
+  read_all(skip, reads);
+}
+
+/* Reads what the layered repair reads for a single failure, k nodes
+   otherwise, or if the layered repair needs a node more loaded than any of
+   the k. */
+
+static int plan_inverse(ML_Plan *plan, int *matrix, int *failed, int *load, int *reads)
+{
+  int skip[ML_NODES], k[ML_NODES];
+  int f;
+
+  f = single(failed);
+  read_k(matrix, failed, load, skip, k);
+  if (f < 0) {
+    memcpy(reads, k, sizeof(k));
+  } else {
+    if (ml_plan_repair(plan, matrix, f, 1, load, reads) < 0) return -1;
+    ml_plan_free(plan);
+    if (max_load(load, k) < max_load(load, reads)) memcpy(reads, k, sizeof(k));
+  }
+  return ml_plan_combine(plan, matrix, failed, reads);
+}
+
+static int plan_subset(ML_Plan *plan, int *matrix, int *failed, int *load, int *reads)
+{
+  int f;
+
+  f = single(failed);
+  if (f < 0) return -1;
+  return ml_plan_repair(plan, matrix, f, 0, load, reads);
+}
+
+/* The unread nodes are rebuilt along with the failed ones. */
+
+static int plan_full(ML_Plan *plan, int *matrix, int *failed, int *load, int *reads)
+{
+  int skip[ML_NODES];
+
+  read_k(matrix, failed, load, skip, reads);
+  return ml_plan_rebuild(plan, matrix, skip);
+}
+
+static int plan_layered(ML_Plan *plan, int *matrix, int *failed, int *load, int *reads)
+{
+  int f;
+
+  f = single(failed);
+  if (f < 0) return -1;
+  return ml_plan_repair(plan, matrix, f, 1, load, reads);
+}
+
+static int count_cells(int *reads)
+{
+  int i, t, n;
+
+  n = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    for (t = 0; t < ML_SUBS; t++) n += (reads[i] >> t) & 1;
+  }
+  return n;
+}
+
+/* Joint repair of several failures in one pass.  The helper cells of the
+   layered repair of each failed node are read once for all of them, minus
+   the cells of the other failed nodes; cells are then left out one at a
+   time, the nodes in drop order and the highest numbered cell first, as
+   long as every lost cell still follows from the rest.  Whichever of that
+   and the k nodes of a full decode has the least loaded nodes, then reads
+   fewer cells, is read, and each lost cell is one combination of it, as
+   for inverse. */
+
+static int plan_joint(ML_Plan *plan, int *matrix, int *failed, int *load, int *reads)
+{
+  ML_Plan probe;
+  int one[ML_NODES], skip[ML_NODES], r[ML_NODES], order[ML_NODES];
+  int i, x, f, t, joint;
+
+  if (nfailed(failed) < 2) return -1;
+  read_k(matrix, failed, load, skip, reads);
+
+  joint = 1;
+  for (i = 0; i < ML_NODES; i++) r[i] = 0;
+  for (f = 0; f < ML_NODES && joint; f++) {
+    if (!failed[f]) continue;
+    if (ml_plan_repair(&probe, matrix, f, 1, load, one) < 0) {
+      joint = 0;
+      continue;
+    }
+    ml_plan_free(&probe);
+    for (i = 0; i < ML_NODES; i++) r[i] |= failed[i] ? 0 : one[i];
+  }
+  if (joint && ml_plan_combine(&probe, matrix, failed, r) == 0) {
+    ml_plan_free(&probe);
+    drop_order(load, order);
+    for (x = 0; x < ML_NODES; x++) {
+      i = order[x];
+      for (t = ML_SUBS-1; t >= 0; t--) {
+        if (!((r[i] >> t) & 1)) continue;
+        r[i] &= ~(1 << t);
+        if (ml_plan_combine(&probe, matrix, failed, r) < 0) {
+          r[i] |= 1 << t;
+          continue;
+        }
+        ml_plan_free(&probe);
+      }
+    }
+    if (max_load(load, r) < max_load(load, reads) ||
+        (max_load(load, r) == max_load(load, reads) && count_cells(r) < count_cells(reads))) {
+      memcpy(reads, r, sizeof(r));
+    }
+  }
+  return ml_plan_combine(plan, matrix, failed, reads);
+}
+
+ML_Backend ml_backends[ML_REPAIR_BACKENDS] = {
+  { "inverse", "repair-1", plan_inverse },
+  { "subset",  "repair-2", plan_subset },
+  { "full",    "repair-3", plan_full },
+  { "layered", "repair-4", plan_layered },
+  { "joint",   "repair",   plan_joint },
+};
+
+static void use_pair(int *used, int layer)
+{
+  used[ml_layers[layer].lo] = 1;
+  used[ml_layers[layer].hi] = 1;
+}
+
+int ml_repair_estimate(ML_Repair *rp, int backend, int *matrix, int *failed, int *load)
+{
+  ML_Op *op;
+  int i, t, c;
+
+  rp->backend = backend;
+  for (i = 0; i < ML_NODES; i++) {
+    rp->failed[i] = (failed[i] != 0);
+    rp->load[i] = (load != NULL && !failed[i]) ? load[i] : 0;
+  }
+  if (ml_backends[backend].plan(&rp->plan, matrix, rp->failed, rp->load, rp->reads) < 0) return -1;
+  rp->hot = max_load(rp->load, rp->reads);
+
+  rp->read_cells = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    rp->used[i] = rp->failed[i] || rp->reads[i] != 0;
+    for (t = 0; t < ML_SUBS; t++) rp->read_cells += (rp->reads[i] >> t) & 1;
+  }
+
+  rp->gf_cells = 0;
+  for (i = 0; i < rp->plan.nops; i++) {
+    op = rp->plan.ops + i;
+    switch (op->type) {
+      case ML_UNCOUPLE:
+      case ML_COUPLE:
+        rp->gf_cells += 3;
+        use_pair(rp->used, op->layer);
+        break;
+      case ML_SOLVE:
+        for (c = 0; c < ML_NODES; c++) {
+          if (!((op->mask >> c) & 1)) continue;
+          rp->gf_cells += ML_K;
+          rp->used[c] = 1;
+        }
+        break;
+      case ML_COMBINE:
+        for (c = 0; c < ML_SUBS*ML_NODES; c++) rp->gf_cells += (op->dm[c] != 0);
+        break;
+      default:
+        rp->gf_cells++;
+        rp->used[ML_CELL_NODE(op->dst)] = 1;
+        break;
+    }
+  }
+  rp->mem_cells = 0;
+  for (i = 0; i < ML_NODES; i++) rp->mem_cells += rp->used[i] ? ML_SUBS : 0;
+
+  rp->cost = (double) rp->read_cells*ML_COST_READ + (double) rp->gf_cells*ML_COST_GF +
+             (double) rp->mem_cells*ML_COST_MEM;
+  return 0;
+}
+
+int ml_repair_choose(ML_Repair *rp, int *matrix, int *failed, int *load, FILE *report)
+{
+  ML_Repair *try;
+  int b, best;
+
+  try = (ML_Repair *) malloc(sizeof(ML_Repair));
+  if (try == NULL) return -1;
+  best = -1;
+  for (b = 0; b < ML_REPAIR_BACKENDS; b++) {
+    if (ml_repair_estimate(try, b, matrix, failed, load) < 0) {
+      if (report != NULL) fprintf(report, "  %-8s (%s): cannot repair this set\n",
+                                  ml_backends[b].name, ml_backends[b].program);
+      continue;
+    }
+    if (report != NULL) {
+      fprintf(report, "  %-8s (%s): read %3ld cells, gf %4ld cells, memory %3ld cells, cost %.0f",
+              ml_backends[b].name, ml_backends[b].program, try->read_cells, try->gf_cells,
+              try->mem_cells, try->cost);
+      if (load != NULL) fprintf(report, ", load %d", try->hot);
+      fprintf(report, "\n");
+    }
+    if (best < 0 || try->hot < rp->hot || (try->hot == rp->hot && try->cost < rp->cost)) {
+      if (best >= 0) ml_repair_free(rp);
+      memcpy(rp, try, sizeof(ML_Repair));
+      best = b;
+    } else {
+      ml_repair_free(try);
+    }
+  }
+  free(try);
+  return best;
+}
+
+/* Plan cache files are named by the code, the backend asked for and the
+   failed set, and hold the ML_Repair as planned. */
+
+static char *cache_name(char *cache, int backend, int *failed)
+{
+  char *fname;
+  int i, mask;
+
+  mask = 0;
+  for (i = 0; i < ML_NODES; i++) mask |= (failed[i] != 0) << i;
+  fname = talloc(char, strlen(cache)+64);
+  if (fname == NULL) return NULL;
+  sprintf(fname, "%s/ml-%d-%d-%d-%s-%04x.plan", cache, ML_K, ML_M, ML_W,
+          (backend < 0) ? "any" : ml_backends[backend].name, mask);
+  return fname;
+}
+
+static int cache_load(ML_Repair *rp, char *fname, int *failed)
+{
+  FILE *fp;
+  int i, k, m, w;
+
+  fp = fopen(fname, "r");
+  if (fp == NULL) return -1;
+  if (fscanf(fp, "ml-plan %d %d %d %d", &k, &m, &w, &rp->backend) != 4 ||
+      k != ML_K || m != ML_M || w != ML_W || rp->backend < 0 || rp->backend >= ML_REPAIR_BACKENDS) {
+    fclose(fp);
+    return -1;
+  }
+  rp->hot = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    rp->failed[i] = (failed[i] != 0);
+    rp->load[i] = 0;
+    if (fscanf(fp, "%d %d", rp->reads+i, rp->used+i) != 2) {
+      fclose(fp);
+      return -1;
+    }
+  }
+  if (fscanf(fp, "%ld %ld %ld %lf", &rp->read_cells, &rp->gf_cells, &rp->mem_cells, &rp->cost) != 4 ||
+      ml_plan_read(fp, &rp->plan) < 0) {
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+  return 0;
+}
+
+/* Written to a temporary file and renamed, so that a repair running at the
+   same time never sees half a plan. */
+
+static void cache_save(ML_Repair *rp, char *fname)
+{
+  FILE *fp;
+  char *tmp;
+  int i, fd;
+
+  tmp = talloc(char, strlen(fname)+8);
+  if (tmp == NULL) return;
+  sprintf(tmp, "%s.XXXXXX", fname);
+  fd = mkstemp(tmp);
+  if (fd < 0) {
+    free(tmp);
+    return;
+  }
+  fp = fdopen(fd, "w");
+  if (fp == NULL) {
+    close(fd);
+    unlink(tmp);
+    free(tmp);
+    return;
+  }
+  fchmod(fd, 0644);
+  fprintf(fp, "ml-plan %d %d %d %d\n", ML_K, ML_M, ML_W, rp->backend);
+  for (i = 0; i < ML_NODES; i++) fprintf(fp, "%d %d\n", rp->reads[i], rp->used[i]);
+  fprintf(fp, "%ld %ld %ld %.17g\n", rp->read_cells, rp->gf_cells, rp->mem_cells, rp->cost);
+  if (ml_plan_write(fp, &rp->plan) < 0 || fclose(fp) != 0 || rename(tmp, fname) < 0) unlink(tmp);
+  free(tmp);
+}
+
+/* Plans made or loaded in this process, by backend asked for, failed set,
+   load levels and coding matrix.  A program that repairs many stripes, or serves
+   degraded reads, asks for the same few failed sets over and over; after
+   the first time each is a lookup and a copy.  The load levels change as
+   the helpers do, so at most ML_REPAIR_PLANS plans are kept, and the one
+   used least recently makes room for a new one. */
+
+typedef struct {
+  int backend;
+  int mask;
+  int matrix[ML_M*ML_K];
+  long used;
+  ML_Repair rp;
+} Memo;
+
+static struct {
+  Memo *memo;
+  int n, size;
+  long clock;
+  pthread_mutex_t lock;
+} plans = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int failed_mask(int *failed)
+{
+  int i, mask;
+
+  mask = 0;
+  for (i = 0; i < ML_NODES; i++) mask |= (failed[i] != 0) << i;
+  return mask;
+}
+
+static int repair_copy(ML_Repair *dst, ML_Repair *src)
+{
+  memcpy(dst, src, sizeof(ML_Repair));
+  return ml_plan_copy(&dst->plan, &src->plan);
+}
+
+static int memo_find(ML_Repair *rp, int backend, int *matrix, int *failed, int *load)
+{
+  Memo *mo;
+  int lv[ML_NODES];
+  int i, mask, rv;
+
+  mask = failed_mask(failed);
+  for (i = 0; i < ML_NODES; i++) lv[i] = (load != NULL && !failed[i]) ? load[i] : 0;
+  rv = -1;
+  pthread_mutex_lock(&plans.lock);
+  for (i = 0; i < plans.n; i++) {
+    mo = plans.memo+i;
+    if (mo->backend == backend && mo->mask == mask && memcmp(mo->rp.load, lv, sizeof(lv)) == 0 &&
+        memcmp(mo->matrix, matrix, sizeof(mo->matrix)) == 0) {
+      rv = repair_copy(rp, &mo->rp);
+      mo->used = ++plans.clock;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&plans.lock);
+  return rv;
+}
+
+static void memo_add(ML_Repair *rp, int backend, int *matrix, int *failed)
+{
+  Memo *mo;
+  int i;
+
+  pthread_mutex_lock(&plans.lock);
+  if (plans.n == ML_REPAIR_PLANS) {
+    mo = plans.memo;
+    for (i = 1; i < plans.n; i++) {
+      if (plans.memo[i].used < mo->used) mo = plans.memo+i;
+    }
+    ml_repair_free(&mo->rp);
+    *mo = plans.memo[--plans.n];
+  }
+  if (plans.n == plans.size) {
+    mo = (Memo *) realloc(plans.memo, sizeof(Memo)*(plans.size*2+16));
+    if (mo == NULL) {
+      pthread_mutex_unlock(&plans.lock);
+      return;
+    }
+    plans.memo = mo;
+    plans.size = plans.size*2+16;
+  }
+  mo = plans.memo+plans.n;
+  mo->backend = backend;
+  mo->mask = failed_mask(failed);
+  memcpy(mo->matrix, matrix, sizeof(mo->matrix));
+  mo->used = ++plans.clock;
+  if (repair_copy(&mo->rp, rp) == 0) plans.n++;
+  pthread_mutex_unlock(&plans.lock);
+}
+
+int ml_repair_plan(ML_Repair *rp, int backend, int *matrix, int *failed, int *load, char *cache,
+                   FILE *report)
+{
+  char *fname;
+  int i, rv;
+
+  if (load != NULL && report != NULL) {
+    fprintf(report, "Loaded helpers (level):");
+    for (i = 0; i < ML_NODES; i++) {
+      if (!failed[i] && load[i] > 0) fprintf(report, " %d (%d)", i, load[i]);
+    }
+    fprintf(report, "\n");
+  }
+  if (memo_find(rp, backend, matrix, failed, load) == 0) {
+    if (report != NULL) fprintf(report, "Repair plan made before in this process\n");
+    return rp->backend;
+  }
+
+  /* The cache directory holds the plans for unloaded helpers only. */
+
+  fname = (cache != NULL && *cache != '\0' && load == NULL) ? cache_name(cache, backend, failed) : NULL;
+  if (fname != NULL && cache_load(rp, fname, failed) == 0) {
+    if (report != NULL) fprintf(report, "Repair plan from %s\n", fname);
+    free(fname);
+    memo_add(rp, backend, matrix, failed);
+    return rp->backend;
+  }
+  if (backend >= 0) {
+    rv = (ml_repair_estimate(rp, backend, matrix, failed, load) < 0) ? -1 : backend;
+  } else {
+    if (report != NULL) fprintf(report, "Repair costs per read-in:\n");
+    rv = ml_repair_choose(rp, matrix, failed, load, report);
+  }
+  if (rv >= 0 && fname != NULL) cache_save(rp, fname);
+  if (rv >= 0) memo_add(rp, backend, matrix, failed);
+  free(fname);
+  return rv;
+}
+
+int ml_repair_warm(int *matrix, int maxfailed, char *cache)
+{
+  ML_Repair rp;
+  int failed[ML_NODES];
+  int i, mask, n, planned;
+
+  planned = 0;
+  for (mask = 1; mask < (1 << ML_NODES); mask++) {
+    n = 0;
+    for (i = 0; i < ML_NODES; i++) {
+      failed[i] = (mask >> i) & 1;
+      n += failed[i];
+    }
+    if (n > maxfailed || n > ML_M) continue;
+    if (ml_repair_plan(&rp, -1, matrix, failed, NULL, cache, NULL) < 0) continue;
+    ml_repair_free(&rp);
+    planned++;
+  }
+  return planned;
+}
+
+/* Read times seen by this process: seconds per megabyte of each node, a
+   moving average over its reads. */
+
+static struct {
+  double sec[ML_NODES];
+  pthread_mutex_t lock;
+} seen = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void observe(long *bytes, double *secs)
+{
+  double x;
+  int i;
+
+  pthread_mutex_lock(&seen.lock);
+  for (i = 0; i < ML_NODES; i++) {
+    if (bytes[i] <= 0) continue;
+    x = secs[i]*(1 << 20)/bytes[i];
+    seen.sec[i] = (seen.sec[i] > 0) ? seen.sec[i]*0.75 + x*0.25 : x;
+  }
+  pthread_mutex_unlock(&seen.lock);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+  double x, y;
+
+  x = *(double *) a;
+  y = *(double *) b;
+  return (x > y) - (x < y);
+}
+
+int ml_repair_loads(int *failed, int *load)
+{
+  FILE *fp;
+  char *status, line[256];
+  double hint[ML_NODES], sorted[ML_NODES], h, ref, low;
+  int i, n, hot;
+
+  for (i = 0; i < ML_NODES; i++) hint[i] = -1;
+  status = getenv(ML_REPAIR_LOAD);
+  fp = (status != NULL && *status != '\0') ? fopen(status, "r") : NULL;
+  if (fp != NULL) {
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      if (sscanf(line, "%d %lf", &i, &h) == 2 && i >= 0 && i < ML_NODES && h >= 0) hint[i] = h;
+    }
+    fclose(fp);
+  } else {
+    pthread_mutex_lock(&seen.lock);
+    for (i = 0; i < ML_NODES; i++) hint[i] = (seen.sec[i] > 0) ? seen.sec[i] : -1;
+    pthread_mutex_unlock(&seen.lock);
+  }
+
+  /* Levels against the median survivor, or half the least positive hint
+     if most are 0. */
+
+  n = 0;
+  low = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    if (failed[i] || hint[i] < 0) continue;
+    sorted[n++] = hint[i];
+    if (hint[i] > 0 && (low == 0 || hint[i] < low)) low = hint[i];
+  }
+  ref = 0;
+  if (n > 0) {
+    qsort(sorted, n, sizeof(double), compare_doubles);
+    ref = (sorted[(n-1)/2] > 0) ? sorted[(n-1)/2] : low/2;
+  }
+  hot = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    load[i] = 0;
+    if (failed[i] || ref <= 0 || hint[i] < 2*ref) continue;
+    for (h = hint[i]/ref; h >= 2 && load[i] < 30; h /= 2) load[i]++;
+    hot++;
+  }
+  return hot;
+}
+
+int ml_repair_run(ML_Repair *rp, int *matrix, char **nodes, int blocksize, int tile)
+{
+  int off, size;
+
+  if (tile <= 0) tile = ML_TILE;
+  for (off = 0; off < blocksize; off += tile) {
+    size = (off+tile <= blocksize) ? tile : blocksize-off;
+    if (ml_plan_run(&rp->plan, matrix, nodes, blocksize, off, size) < 0) return -1;
+  }
+  return 0;
+}
+
+void ml_repair_report(FILE *f, ML_Repair *rp, int blocksize, int readins, long actual)
+{
+  fprintf(f, "Repair strategy: %s (%s)\n", ml_backends[rp->backend].name,
+          ml_backends[rp->backend].program);
+  fprintf(f, "Bytes read: predicted %ld, actual %ld\n",
+          rp->read_cells*blocksize*readins, actual);
+  fprintf(f, "GF region bytes: %ld, buffer bytes: %ld\n", rp->gf_cells*blocksize*readins,
+          (rp->mem_cells*blocksize < ML_REPAIR_MEMORY) ? rp->mem_cells*blocksize : (long) ML_REPAIR_MEMORY);
+}
+
+void ml_repair_free(ML_Repair *rp)
+{
+  ml_plan_free(&rp->plan);
+}
+
+static int node_blocksize(char **fnames, int *failed, int readins)
+{
+  struct stat status;
+  int i;
+
+  for (i = 0; i < ML_NODES; i++) {
+    if (!failed[i] && stat(fnames[i], &status) == 0) return status.st_size/(ML_SUBS*readins);
+  }
+  return -1;
+}
+
+static void gate_wait(sem_t *gate)
+{
+  if (gate == NULL) return;
+  while (sem_wait(gate) < 0) ;
+}
+
+static void gate_post(sem_t *gate)
+{
+  if (gate != NULL) sem_post(gate);
+}
+
+/* The journal of a node being repaired is the file fname.journal next to
+   fname.partial: a header line with the read-ins, cell size and layout,
+   then one line per batch of read-ins written, with the CRC-32 of each of
+   its cells.  Lines go out at checkpoints, once the node file has been
+   synced up to them, so every line stands for data on disk.  The journal
+   is locked while its repair runs. */
+
+typedef struct {
+  int n, nb;
+  unsigned int crc[ML_SUBS];
+  long end;                     /* Offset in the journal after this line */
+} Record;
+
+typedef struct {
+  int fd;
+  char *name;
+  Record *rec;
+  int nrec;
+  unsigned int crc[ML_SUBS];    /* Of the batch being written */
+  char *pending;                /* Lines waiting for the next checkpoint */
+  long npending;
+  long apending;
+  long unsynced;                /* Bytes written since the last checkpoint */
+} Journal;
+
+static unsigned int crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void)
+{
+  unsigned int c;
+  int i, b;
+
+  for (i = 0; i < 256; i++) {
+    c = i;
+    for (b = 0; b < 8; b++) c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+    crc_table[i] = c;
+  }
+}
+
+static unsigned int crc32_update(unsigned int crc, char *buf, long len)
+{
+  unsigned char *p;
+  long i;
+
+  pthread_once(&crc_once, crc_init);
+  p = (unsigned char *) buf;
+  crc = ~crc;
+  for (i = 0; i < len; i++) crc = crc_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void journal_header(char *line, ML_Layout *lay)
+{
+  sprintf(line, "ml-journal %d %d %d\n", lay->readins, lay->blocksize, lay->layout);
+}
+
+/* Opens and locks the journal of fname and reads its records, the header
+   checked against lay.  A journal that does not match is started over. */
+
+static int journal_open(Journal *j, char *fname, ML_Layout *lay)
+{
+  char head[96], *text, *p, *q;
+  long len;
+
+  j->rec = NULL;
+  j->nrec = 0;
+  j->pending = NULL;
+  j->npending = 0;
+  j->apending = 0;
+  j->unsynced = 0;
+  j->name = talloc(char, strlen(fname)+16);
+  if (j->name == NULL) return -1;
+  sprintf(j->name, "%s.journal", fname);
+  j->fd = open(j->name, O_RDWR | O_CREAT, 0644);
+  if (j->fd < 0) {
+    fprintf(stderr, "Error: cannot open %s\n", j->name);
+    return -1;
+  }
+  if (flock(j->fd, LOCK_EX | LOCK_NB) < 0) {
+    fprintf(stderr, "Error: %s is being repaired already\n", fname);
+    close(j->fd);
+    j->fd = -1;
+    return -1;
+  }
+
+  journal_header(head, lay);
+  len = lseek(j->fd, 0, SEEK_END);
+  text = talloc(char, len+1);
+  j->rec = talloc(Record, lay->readins > 0 ? lay->readins : 1);
+  if (text == NULL || j->rec == NULL || pread(j->fd, text, len, 0) != len) {
+    free(text);
+    return -1;
+  }
+  text[len] = '\0';
+  if (len < (long) strlen(head) || strncmp(text, head, strlen(head)) != 0) {
+    free(text);
+    if (ftruncate(j->fd, 0) < 0 || lseek(j->fd, 0, SEEK_SET) < 0 ||
+        write(j->fd, head, strlen(head)) != (ssize_t) strlen(head)) return -1;
+    return 0;
+  }
+
+  /* Whole lines only: the last one may have been cut short by the crash */
+  p = text + strlen(head);
+  while (j->nrec < lay->readins && (q = strchr(p, '\n')) != NULL) {
+    Record *r = j->rec + j->nrec;
+    *q = '\0';
+    if (sscanf(p, "%d %d %x %x %x %x %x %x %x %x", &r->n, &r->nb, r->crc, r->crc+1, r->crc+2,
+               r->crc+3, r->crc+4, r->crc+5, r->crc+6, r->crc+7) != 2+ML_SUBS) break;
+    r->end = q+1 - text;
+    j->nrec++;
+    p = q+1;
+  }
+  free(text);
+  return 0;
+}
+
+/* How many read-ins from the start the journal vouches for, checked
+   against the CRCs of what fname.partial holds, in windows of width
+   columns through buf. */
+
+static int journal_verify(Journal *j, ML_Writer *wr, ML_Layout *lay, char *buf, long width, long *bytes)
+{
+  Record *r;
+  unsigned int crc[ML_SUBS];
+  long col, cw, got, b;
+  double sec;
+  int x, t, n, mask;
+
+  mask = (1 << ML_SUBS)-1;
+  n = 0;
+  for (x = 0; x < j->nrec; x++) {
+    r = j->rec + x;
+    if (r->n != n || r->nb <= 0 || r->n+r->nb > lay->readins) break;
+    for (t = 0; t < ML_SUBS; t++) crc[t] = 0;
+    for (col = 0; col < (long) r->nb*lay->blocksize; col += cw) {
+      cw = ((long) r->nb*lay->blocksize-col < width) ? (long) r->nb*lay->blocksize-col : width;
+      got = ml_read_cols(1, &wr->tmp, &mask, lay, r->n, r->nb, col, cw, &buf, &b, &sec);
+      if (got < 0) break;
+      *bytes += got;
+      for (t = 0; t < ML_SUBS; t++) crc[t] = crc32_update(crc[t], buf + t*cw, cw);
+    }
+    if (col < (long) r->nb*lay->blocksize || memcmp(crc, r->crc, sizeof(crc)) != 0) break;
+    n += r->nb;
+  }
+  return n;
+}
+
+/* Drops the records past read-in start. */
+
+static int journal_cut(Journal *j, ML_Layout *lay, int start)
+{
+  char head[96];
+  int x;
+
+  for (x = 0; x < j->nrec && j->rec[x].n + j->rec[x].nb <= start; x++) ;
+  j->nrec = x;
+  journal_header(head, lay);
+  if (ftruncate(j->fd, (x > 0) ? j->rec[x-1].end : (long) strlen(head)) < 0) return -1;
+  return (lseek(j->fd, 0, SEEK_END) < 0) ? -1 : 0;
+}
+
+static int journal_add(Journal *j, int n, int nb, long bytes)
+{
+  char line[160], *p;
+  int t, len;
+
+  len = sprintf(line, "%d %d", n, nb);
+  for (t = 0; t < ML_SUBS; t++) len += sprintf(line+len, " %08x", j->crc[t]);
+  line[len++] = '\n';
+  if (j->npending + len > j->apending) {
+    p = (char *) realloc(j->pending, j->apending*2 + len);
+    if (p == NULL) return -1;
+    j->pending = p;
+    j->apending = j->apending*2 + len;
+  }
+  memcpy(j->pending + j->npending, line, len);
+  j->npending += len;
+  j->unsynced += bytes;
+  return 0;
+}
+
+/* Makes the node file durable up to the pending lines, then the lines. */
+
+static int journal_checkpoint(Journal *j, ML_Writer *wr)
+{
+  if (j->npending == 0) return 0;
+  if (fdatasync(wr->fd) < 0) return -1;
+  if (write(j->fd, j->pending, j->npending) != j->npending || fdatasync(j->fd) < 0) return -1;
+  j->npending = 0;
+  j->unsynced = 0;
+  return 0;
+}
+
+static void journal_close(Journal *j, int done)
+{
+  if (j->fd >= 0) {
+    if (done) unlink(j->name);
+    close(j->fd);
+  }
+  free(j->name);
+  free(j->rec);
+  free(j->pending);
+}
+
+/* The reconstruction cache of a node being repaired is the file
+   fname.rcache: one byte per read-in, set once that read-in is in the
+   temporary node file, followed by the name of that file.  It is made
+   under a temporary name and renamed into place, and removed once the node
+   file is. */
+
+static char *rcache_name(char *fname)
+{
+  char *name;
+
+  name = talloc(char, strlen(fname)+8);
+  if (name != NULL) sprintf(name, "%s.rcache", fname);
+  return name;
+}
+
+static int publish_open(ML_Writer *wr, char *fname, int readins)
+{
+  char *name, *tmp, *flags;
+  int fd;
+
+  name = rcache_name(fname);
+  tmp = talloc(char, strlen(fname)+16);
+  flags = talloc(char, readins > 0 ? readins : 1);
+  fd = -1;
+  if (name == NULL || tmp == NULL || flags == NULL) goto done;
+  sprintf(tmp, "%s.XXXXXX", name);
+  fd = mkstemp(tmp);
+  if (fd < 0) goto done;
+  fchmod(fd, 0644);
+  memset(flags, 0, readins);
+  if (write(fd, flags, readins) != readins || write(fd, wr->tmp, strlen(wr->tmp)) != (ssize_t) strlen(wr->tmp) ||
+      rename(tmp, name) < 0) {
+    close(fd);
+    unlink(tmp);
+    fd = -1;
+  }
+
+done:
+  free(name);
+  free(tmp);
+  free(flags);
+  return fd;
+}
+
+static void publish(int fd, int n, int nb)
+{
+  char flags[256];
+  int j;
+
+  memset(flags, 1, sizeof(flags));
+  for (j = 0; j < nb; j += sizeof(flags)) {
+    if (pwrite(fd, flags, (nb-j < (int) sizeof(flags)) ? nb-j : (int) sizeof(flags), n+j) < 0) return;
+  }
+}
+
+static void publish_close(int fd, char *fname)
+{
+  char *name;
+
+  if (fd < 0) return;
+  close(fd);
+  name = rcache_name(fname);
+  if (name != NULL) unlink(name);
+  free(name);
+}
+
+int ml_repair_exec(ML_Repair *rp, int *matrix, char **fnames, int readins, int layout, long mem,
+                   sem_t *io, sem_t *cpu, ML_IO_Account *acct)
+{
+  ML_Writer out[ML_NODES];
+  ML_Layout lay;
+  Journal jr[ML_NODES];
+  char *nodes[ML_NODES];
+  int pub[ML_NODES];
+  long bytes[ML_NODES];
+  double secs[ML_NODES];
+  long got, col, cw, width, verified;
+  int i, t, n, nb, batch, blocksize, nused, start, rv;
+
+  blocksize = node_blocksize(fnames, rp->failed, readins);
+  if (blocksize < 0) return -1;
+  ml_qos_open(getenv(ML_REPAIR_QOS));
+  lay.layout = layout;
+  lay.readins = readins;
+  lay.cells = ML_SUBS;
+  lay.blocksize = blocksize;
+
+  /* Grouped node files hold each cell of consecutive read-ins back to back,
+     so they are repaired batch read-ins at a time, one extent per cell. */
+
+  batch = 1;
+  if (layout == ML_LAYOUT_GROUPED) {
+    batch = ML_REPAIR_EXTENT/blocksize;
+    if (batch < 1) batch = 1;
+    if (batch > readins) batch = readins;
+  }
+
+  /* The buffers hold a window of width columns of every cell of every node
+     the plan uses, width a multiple of ML_TILE and all of them within mem. */
+
+  if (mem <= 0) mem = ML_REPAIR_MEMORY;
+  for (nused = 0, i = 0; i < ML_NODES; i++) nused += (rp->used[i] != 0);
+  width = mem/((long) (nused > 0 ? nused : 1)*ML_SUBS);
+  width -= width % ML_TILE;
+  if (width < ML_TILE) width = ML_TILE;
+  if (width > (long) batch*blocksize) width = (long) batch*blocksize;
+
+  rv = -1;
+  for (i = 0; i < ML_NODES; i++) {
+    nodes[i] = NULL;
+    out[i].fd = -1;
+    pub[i] = -1;
+    jr[i].fd = -1;
+    jr[i].name = NULL;
+    jr[i].rec = NULL;
+    jr[i].pending = NULL;
+  }
+  start = readins;
+  verified = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    if (rp->used[i]) {
+      nodes[i] = (char *) malloc(sizeof(char)*ML_SUBS*width);
+      if (nodes[i] == NULL) goto done;
+    }
+    if (rp->failed[i]) {
+      if (journal_open(jr+i, fnames[i], &lay) < 0) goto done;
+      if (ml_writer_open_partial(out+i, fnames[i], (long) readins*ML_SUBS*blocksize) < 0) goto done;
+      n = journal_verify(jr+i, out+i, &lay, nodes[i], width, &verified);
+      if (n < start) start = n;
+    }
+  }
+
+  /* Take up a repair that was cut short where every failed node's journal
+     and node file agree, then publish what is there already. */
+
+  for (i = 0; i < ML_NODES; i++) {
+    if (!rp->failed[i]) continue;
+    if (journal_cut(jr+i, &lay, start) < 0) goto done;
+    pub[i] = publish_open(out+i, fnames[i], readins);
+    if (pub[i] >= 0 && start > 0) publish(pub[i], 0, start);
+  }
+  if (start > 0) {
+    fprintf(stderr, "Resuming the repair at read-in %d of %d, %ld bytes checked\n", start, readins, verified);
+  }
+
+  /* Read, repair and write a batch of read-ins at a time, one window of
+     columns at a time.  The plan works column by column, so a window is
+     repaired as one read-in with cells of cw bytes. */
+
+  if (acct != NULL) ml_account_init(acct, (long) readins*blocksize);
+  for (n = start; n < readins; n += nb) {
+    nb = (readins-n < batch) ? readins-n : batch;
+    for (i = 0; i < ML_NODES; i++) {
+      for (t = 0; t < ML_SUBS; t++) jr[i].crc[t] = 0;
+    }
+    for (col = 0; col < (long) nb*blocksize; col += cw) {
+      cw = ((long) nb*blocksize-col < width) ? (long) nb*blocksize-col : width;
+      gate_wait(io);
+      got = ml_read_cols(ML_NODES, fnames, rp->reads, &lay, n, nb, col, cw, nodes, bytes, secs);
+      gate_post(io);
+      if (got < 0) goto done;
+      observe(bytes, secs);
+      if (acct != NULL) {
+        acct->total += got;
+        for (i = 0; i < ML_NODES; i++) {
+          acct->node[i] += bytes[i];
+          for (t = 0; t < ML_SUBS; t++) {
+            if ((rp->reads[i] >> t) & 1) acct->sub[i][t] += cw;
+          }
+        }
+      }
+      gate_wait(cpu);
+      got = ml_repair_run(rp, matrix, nodes, cw, ML_TILE);
+      gate_post(cpu);
+      if (got < 0) goto done;
+      gate_wait(io);
+      for (i = 0; i < ML_NODES; i++) {
+        if (!rp->failed[i]) continue;
+        if (ml_write_cols(out+i, &lay, (1 << ML_SUBS)-1, n, nb, col, cw, nodes[i]) < 0) break;
+        for (t = 0; t < ML_SUBS; t++) jr[i].crc[t] = crc32_update(jr[i].crc[t], nodes[i] + t*cw, cw);
+      }
+      gate_post(io);
+      if (i < ML_NODES) goto done;
+    }
+    for (i = 0; i < ML_NODES; i++) {
+      if (!rp->failed[i]) continue;
+      if (journal_add(jr+i, n, nb, (long) nb*ML_SUBS*blocksize) < 0) goto done;
+      if (jr[i].unsynced >= ML_REPAIR_CHECKPOINT && journal_checkpoint(jr+i, out+i) < 0) goto done;
+      if (pub[i] >= 0) publish(pub[i], n, nb);
+    }
+  }
+  rv = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    if (rp->failed[i] && ml_writer_close(out+i) < 0) {
+      fprintf(stderr, "Error finishing %s\n", fnames[i]);
+      rv = -1;
+    }
+  }
+
+  /* A repair that failed keeps its node files and journals, made durable
+     as far as they got, for the next try to take up. */
+
+done:
+  for (i = 0; i < ML_NODES; i++) {
+    if (rv < 0 && out[i].fd >= 0) {
+      if (jr[i].fd >= 0) journal_checkpoint(jr+i, out+i);
+      ml_writer_suspend(out+i);
+    }
+    journal_close(jr+i, rv == 0);
+    publish_close(pub[i], fnames[i]);
+    free(nodes[i]);
+  }
+  return rv;
+}
+
+int ml_repair_files(int *matrix, char **fnames, int *failed, int backend, int readins, int layout,
+                    FILE *report)
+{
+  ML_Repair rp;
+  ML_IO_Account acct;
+  struct timing t1, t2;
+  int load[ML_NODES];
+  int blocksize, rv;
+
+  blocksize = node_blocksize(fnames, failed, readins);
+  if (blocksize < 0) return -1;
+  if (ml_repair_plan(&rp, backend, matrix, failed, (ml_repair_loads(failed, load) > 0) ? load : NULL,
+                     getenv(ML_REPAIR_CACHE), report) < 0) {
+    if (backend >= 0) fprintf(stderr, "Strategy %s cannot repair these nodes\n", ml_backends[backend].name);
+    else fprintf(stderr, "No strategy can repair these nodes\n");
+    return -1;
+  }
+
+  timing_set(&t1);
+  rv = ml_repair_exec(&rp, matrix, fnames, readins, layout, 0, NULL, NULL, &acct);
+  timing_set(&t2);
+  if (rv == 0 && report != NULL) {
+    ml_repair_report(report, &rp, blocksize, readins, acct.total);
+    fprintf(report, "Repair time (sec): %0.10f\n", timing_delta(&t1, &t2));
+    ml_repair_json(report, failed, ml_backends[rp.backend].name, &acct, timing_delta(&t1, &t2));
+    ml_qos_report(report);
+  }
+  ml_repair_free(&rp);
+  return rv;
+}
+
+void ml_account_init(ML_IO_Account *acct, long cell)
+{
+  memset(acct, 0, sizeof(ML_IO_Account));
+  acct->cell = cell;
+}
+
+/* The cut-set bound of t failed nodes regenerated from d helpers. */
+
+static double cut_set_bound(int t, int d, long alpha)
+{
+  if (d < ML_K) return -1;
+  return (double) t*d*alpha/(d-ML_K+t);
+}
+
+void ml_repair_json(FILE *f, int *failed, char *strategy, ML_IO_Account *acct, double sec)
+{
+  long alpha;
+  double bound, best;
+  int i, t, nf, d, first;
+
+  alpha = acct->cell*ML_SUBS;
+  nf = 0;
+  d = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    nf += (failed[i] != 0);
+    d += (!failed[i] && acct->node[i] > 0);
+  }
+  bound = cut_set_bound(nf, d, alpha);
+  best = cut_set_bound(nf, ML_NODES-nf, alpha);
+
+  fprintf(f, "{\"strategy\": \"%s\", \"failed\": [", strategy);
+  for (i = 0, first = 1; i < ML_NODES; i++) {
+    if (!failed[i]) continue;
+    fprintf(f, "%s%d", first ? "" : ", ", i);
+    first = 0;
+  }
+  fprintf(f, "], \"node_bytes\": %ld, \"cell_bytes\": %ld, \"helpers\": [", alpha, acct->cell);
+  for (i = 0, first = 1; i < ML_NODES; i++) {
+    if (acct->node[i] == 0) continue;
+    fprintf(f, "%s{\"node\": %d, \"bytes\": %ld, \"sub_bytes\": [", first ? "" : ", ", i, acct->node[i]);
+    for (t = 0; t < ML_SUBS; t++) fprintf(f, "%s%ld", (t == 0) ? "" : ", ", acct->sub[i][t]);
+    fprintf(f, "]}");
+    first = 0;
+  }
+  fprintf(f, "], \"read_bytes\": %ld, ", acct->total);
+  if (bound > 0) {
+    fprintf(f, "\"cut_set_bound\": {\"helpers\": %d, \"bytes\": %.0f}, ", d, bound);
+  } else {
+    fprintf(f, "\"cut_set_bound\": null, ");
+  }
+  fprintf(f, "\"cut_set_bound_all\": {\"helpers\": %d, \"bytes\": %.0f}, ", ML_NODES-nf, best);
+  fprintf(f, "\"rs_bytes\": %ld, ", (long) ML_K*alpha);
+  if (bound > 0) fprintf(f, "\"read_vs_bound\": %.4f, ", acct->total/bound);
+  else fprintf(f, "\"read_vs_bound\": null, ");
+  fprintf(f, "\"read_vs_rs\": %.4f, \"time_sec\": %.6f}\n", (alpha > 0) ? (double) acct->total/(ML_K*alpha) : 0,
+          sec);
+}
+
+/* Copies what falls in bytes [off, off+len) of the node file from read-in
+   n, held as ML_SUBS cells in buf, to dst, which stands for offset off.
+   Returns the bytes copied. */
+
+static long copy_readin(ML_Layout *lay, int n, char *buf, long off, long len, char *dst)
+{
+  long o, lo, hi, got;
+  int t;
+
+  got = 0;
+  for (t = 0; t < ML_SUBS; t++) {
+    o = ml_layout_offset(lay, n, t);
+    lo = (o > off) ? o : off;
+    hi = (o+lay->blocksize < off+len) ? o+lay->blocksize : off+len;
+    if (lo >= hi) continue;
+    memcpy(dst + (lo-off), buf + t*lay->blocksize + (lo-o), hi-lo);
+    got += hi-lo;
+  }
+  return got;
+}
+
+static int open_rcache(char *fname, int readins, int *tfd)
+{
+  char *name, *tmp;
+  long len;
+  int fd;
+
+  *tfd = -1;
+  name = rcache_name(fname);
+  if (name == NULL) return -1;
+  fd = open(name, O_RDONLY);
+  free(name);
+  if (fd < 0) return -1;
+  len = lseek(fd, 0, SEEK_END);
+  tmp = talloc(char, len-readins+1 > 1 ? len-readins+1 : 1);
+  if (len <= readins || tmp == NULL || pread(fd, tmp, len-readins, readins) != len-readins) {
+    free(tmp);
+    close(fd);
+    return -1;
+  }
+  tmp[len-readins] = '\0';
+  *tfd = open(tmp, O_RDONLY);
+  free(tmp);
+  if (*tfd < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+long ml_degraded_read(int *matrix, char **fnames, int node, int readins, int layout,
+                      long off, long len, char *buf, ML_Read_Stats *st)
+{
+  ML_Repair rp;
+  ML_Layout lay;
+  char *nodes[ML_NODES];
+  long bytes[ML_NODES];
+  double secs[ML_NODES];
+  int failed[ML_NODES], load[ML_NODES];
+  char flag;
+  long size, got, o, lo, hi;
+  int i, n, t, fd, cfd, tfd, blocksize, planned, rv;
+
+  memset(st, 0, sizeof(ML_Read_Stats));
+  for (i = 0; i < ML_NODES; i++) failed[i] = (i == node);
+  blocksize = node_blocksize(fnames, failed, readins);
+  if (blocksize < 0 || off < 0) return -1;
+  size = (long) readins*ML_SUBS*blocksize;
+  if (off >= size) return 0;
+  if (len > size-off) len = size-off;
+
+  /* Try the node file, then the reconstruction cache of a repair in
+     progress.  The node file is tried again if the cache has gone, since
+     the repair renames the node file into place before removing it. */
+
+  cfd = -1;
+  tfd = -1;
+  for (i = 0; i < 2; i++) {
+    fd = open(fnames[node], O_RDONLY);
+    if (fd >= 0) {
+      got = pread(fd, buf, len, off);
+      close(fd);
+      if (got == len) st->node_bytes = len;
+      return (got == len) ? len : -1;
+    }
+    cfd = open_rcache(fnames[node], readins, &tfd);
+    if (cfd >= 0) break;
+  }
+
+  lay.layout = layout;
+  lay.readins = readins;
+  lay.cells = ML_SUBS;
+  lay.blocksize = blocksize;
+  for (i = 0; i < ML_NODES; i++) nodes[i] = NULL;
+  planned = 0;
+  rv = -1;
+
+  /* Read-ins whose cells overlap the range: published ones are read from
+     the repair's node file, the others decoded here. */
+
+  for (n = 0; n < readins; n++) {
+    for (t = 0; t < ML_SUBS; t++) {
+      o = ml_layout_offset(&lay, n, t);
+      if (o < off+len && o+blocksize > off) break;
+    }
+    if (t == ML_SUBS) continue;
+
+    if (cfd >= 0 && pread(cfd, &flag, 1, n) == 1 && flag) {
+      for (t = 0; t < ML_SUBS; t++) {
+        o = ml_layout_offset(&lay, n, t);
+        lo = (o > off) ? o : off;
+        hi = (o+blocksize < off+len) ? o+blocksize : off+len;
+        if (lo >= hi) continue;
+        if (pread(tfd, buf + (lo-off), hi-lo, lo) != hi-lo) goto done;
+        st->cache_bytes += hi-lo;
+      }
+      continue;
+    }
+
+    if (!planned) {
+      if (ml_repair_plan(&rp, -1, matrix, failed, (ml_repair_loads(failed, load) > 0) ? load : NULL,
+                         getenv(ML_REPAIR_CACHE), NULL) < 0) goto done;
+      planned = 1;
+      for (i = 0; i < ML_NODES; i++) {
+        if (!rp.used[i]) continue;
+        nodes[i] = (char *) malloc(sizeof(char)*ML_SUBS*blocksize);
+        if (nodes[i] == NULL) goto done;
+      }
+    }
+    if (ml_read_cells(ML_NODES, fnames, rp.reads, &lay, n, 1, nodes, bytes, secs) < 0) goto done;
+    observe(bytes, secs);
+    if (ml_repair_run(&rp, matrix, nodes, blocksize, ML_TILE) < 0) goto done;
+    st->decoded_bytes += copy_readin(&lay, n, nodes[node], off, len, buf);
+    st->decodes++;
+  }
+  rv = 0;
+
+done:
+  if (cfd >= 0) close(cfd);
+  if (tfd >= 0) close(tfd);
+  for (i = 0; i < ML_NODES; i++) free(nodes[i]);
+  if (planned) ml_repair_free(&rp);
+  return (rv < 0) ? -1 : len;
+}
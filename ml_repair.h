@@ -0,0 +1,214 @@
+/* ml_repair.h
+ * Repair engine for the multilayer code: rebuilds the node files of failed
+ * nodes, choosing among the strategies of repair-1..4 by a cost model.
+ */
+
+#ifndef _ML_REPAIR_H
+#define _ML_REPAIR_H
+
+#include <stdio.h>
+#include <semaphore.h>
+#include "multilayer.h"
+
+/* Backends, in the order of the stand-alone programs they replace, then
+   those of repair.c alone. */
+
+#define ML_REPAIR_INVERSE 0     /* repair-1: every lost cell as one combination of the cells read */
+#define ML_REPAIR_SUBSET  1     /* repair-2: half the sub-stripes from all helpers, all of it uncoupled */
+#define ML_REPAIR_FULL    2     /* repair-3: full decode, then re-encode the lost nodes */
+#define ML_REPAIR_LAYERED 3     /* repair-4: half the sub-stripes, only the rows and pairs needed */
+#define ML_REPAIR_JOINT   4     /* Several failures at once from the union of their layered reads */
+#define ML_REPAIR_BACKENDS 5
+
+/* Cost weights, per byte.  Reading a byte from a helper is taken to cost as
+   much as ML_COST_READ GF region passes over it; holding it in memory as
+   much as ML_COST_MEM. */
+
+#define ML_COST_READ 16
+#define ML_COST_GF 1
+#define ML_COST_MEM 1
+
+typedef struct {
+  char *name;
+  char *program;
+  int (*plan)(ML_Plan *plan, int *matrix, int *failed, int *load, int *reads);
+} ML_Backend;
+
+extern ML_Backend ml_backends[ML_REPAIR_BACKENDS];
+
+/* Costs are in cells of blocksize bytes, per read-in. */
+
+typedef struct {
+  int backend;
+  int failed[ML_NODES];
+  int reads[ML_NODES];          /* Bit t: cell t of node i is read */
+  int used[ML_NODES];           /* Nodes that need a buffer */
+  int load[ML_NODES];           /* Load levels planned for */
+  int hot;                      /* Highest level of a node read */
+  long read_cells;
+  long gf_cells;                /* Region passes: multiplies, xors and copies */
+  long mem_cells;
+  double cost;
+  ML_Plan plan;
+} ML_Repair;
+
+/* Plans the repair of failed[] with one backend and prices it.  load[] (or
+   NULL) gives a load level per node, 0 for an ordinary one: where the
+   backend has a choice of helpers it reads the least loaded, so that the
+   highest level read is as low as it can be.  Returns -1 if the backend
+   cannot repair this set. */
+
+int ml_repair_estimate(ML_Repair *rp, int backend, int *matrix, int *failed, int *load);
+
+/* Prices every backend and keeps in rp the valid one reading the least
+   loaded helpers, the cheapest among equals.  If report is not NULL, one
+   line per backend is printed to it.  Returns the backend, or -1 if none
+   can repair failed[]. */
+
+int ml_repair_choose(ML_Repair *rp, int *matrix, int *failed, int *load, FILE *report);
+
+/* Either of the two above, through a plan cache: the directory cache (none
+   if NULL or empty) holds one file per backend asked for (-1 for the
+   cheapest) and failed set.  A plan found there is loaded and nothing is
+   planned; otherwise the plan is made and stored.  Plans for loaded
+   helpers (load not NULL) are never kept there.  ml_repair_files() and the
+   repairs of ml_net.h use the directory named by the environment variable
+   ML_PLAN_CACHE.  Returns the backend, or -1. */
+
+#define ML_REPAIR_CACHE "ML_PLAN_CACHE"
+
+/* ml_repair_exec() and the repairs of ml_net.h throttle their I/O through
+   the control file named by the environment variable ML_REPAIR_QOS, if it
+   is set (ml_qos_open(), ml_io.h).  The helper processes of ml_net.h each
+   keep their own buckets, as the machines they stand for would. */
+
+#define ML_REPAIR_QOS "ML_REPAIR_QOS"
+
+int ml_repair_plan(ML_Repair *rp, int backend, int *matrix, int *failed, int *load, char *cache,
+                   FILE *report);
+
+/* The load levels of the helpers of failed[], for ml_repair_plan(), as
+   ml_repair_files(), ml_degraded_read(), rebuild.c and the repairs of
+   ml_net.h take them.  The hints come from the status file named by the
+   environment variable ML_REPAIR_LOAD, lines of a node and a load in any
+   unit (latency, utilization, queue depth), or failing that from the
+   seconds per megabyte of the reads of this process.  A node is at level
+   0 up to twice the median hint of the survivors and one level higher at
+   every doubling after that.  Returns the number of nodes above 0. */
+
+#define ML_REPAIR_LOAD "ML_REPAIR_LOAD"
+
+int ml_repair_loads(int *failed, int *load);
+
+/* ml_repair_plan() also keeps the plans it makes or loads for the rest of
+   the process, and the decoding matrices behind them (multilayer.c), so a
+   failed set at the same load levels is seldom planned twice.  At most
+   ML_REPAIR_PLANS plans are kept, dropping the one used least recently;
+   that is room for every failed set of up to ML_M nodes unloaded, with
+   some to spare for loaded ones.  ml_repair_warm() plans every failed set
+   of 1 to maxfailed nodes with the cheapest backend ahead of time, into
+   the process and into cache if not NULL.  Returns the number of sets
+   that can be repaired. */
+
+#ifndef ML_REPAIR_PLANS
+#define ML_REPAIR_PLANS 4096
+#endif
+
+int ml_repair_warm(int *matrix, int maxfailed, char *cache);
+
+/* Runs the plan over column tiles of nodes[], the ML_SUBS*blocksize buffers
+   of the nodes in rp->used, holding the cells in rp->reads.  The stored
+   cells of the failed nodes are left in their buffers. */
+
+int ml_repair_run(ML_Repair *rp, int *matrix, char **nodes, int blocksize, int tile);
+
+/* The whole repair of a file: fnames[i] is the file of node i, failed[] the
+   nodes to rebuild, layout that of the node files (ml_io.h).  Uses backend,
+   or the cheapest one if backend is -1, reads what it needs one read-in at
+   a time (up to ML_REPAIR_EXTENT bytes of each cell at a time for grouped
+   files) in windows that fit ML_REPAIR_MEMORY, and prints the costs, the
+   choice and the bytes read to report if not NULL.  Only the failed node
+   files are written, each to a temporary file that is renamed into place
+   once it is complete. */
+
+#define ML_REPAIR_EXTENT (1 << 20)
+
+int ml_repair_files(int *matrix, char **fnames, int *failed, int backend, int readins, int layout,
+                    FILE *report);
+
+/* The reading, repair and writing of ml_repair_files() for a plan made
+   beforehand, which may be shared by several threads repairing different
+   files at once.  The cells go through buffers of at most mem bytes in all
+   (ML_REPAIR_MEMORY if 0), a window of columns at a time, whatever the size
+   of the file.  If io is not NULL it is held around every read and write
+   of a window, and cpu around every run of the plan, so a pool of workers
+   can bound its I/O and its compute separately.  The bytes read are
+   counted in acct, if not NULL.
+
+   Each failed node file is written as fname.partial, with a journal
+   fname.journal of the read-ins done and the CRC-32 of their cells, made
+   durable every ML_REPAIR_CHECKPOINT bytes written.  A repair that fails
+   or is killed leaves both behind, and the next repair of the same node
+   checks the cells the journal names against the partial file and goes on
+   from the first read-in that does not match, rather than from the start.
+   The journal is locked, so two repairs of one node refuse to run at
+   once. */
+
+#define ML_REPAIR_MEMORY (16 << 20)
+#ifndef ML_REPAIR_CHECKPOINT
+#define ML_REPAIR_CHECKPOINT (64 << 20)
+#endif
+
+/* Bytes read from the helpers in a repair: in all, from each node, and from
+   each cell (sub-stripe) of each node.  cell is the size of one cell over
+   all read-ins, an eighth of a node file. */
+
+typedef struct {
+  long cell;
+  long total;
+  long node[ML_NODES];
+  long sub[ML_NODES][ML_SUBS];
+} ML_IO_Account;
+
+int ml_repair_exec(ML_Repair *rp, int *matrix, char **fnames, int readins, int layout, long mem,
+                   sem_t *io, sem_t *cpu, ML_IO_Account *acct);
+
+/* Starts an account with cells of cell bytes. */
+
+void ml_account_init(ML_IO_Account *acct, long cell);
+
+/* Prints acct as one line of JSON, for the failed nodes of failed[] and a
+   repair named strategy that took sec seconds, with the bounds to hold it
+   against: the cut-set bound for regenerating t failed nodes from d
+   helpers, t*d*alpha/(d-k+t) for alpha-byte node files, at the d helpers
+   read and at the most there can be (n-t), and the k*alpha of a
+   Reed-Solomon repair, which reads k whole nodes.  read_vs_bound and
+   read_vs_rs are the bytes read over the first bound and over k*alpha. */
+
+void ml_repair_json(FILE *f, int *failed, char *strategy, ML_IO_Account *acct, double sec);
+
+/* Degraded reads.  While ml_repair_exec() rebuilds a node it publishes
+   every read-in it has written to a reconstruction cache next to the node
+   file (fname.rcache), removed once the node file is in place.
+
+   ml_degraded_read() reads bytes [off, off+len) of the file of node into
+   buf: from the node file if it is there, otherwise from the read-ins a
+   repair in progress has published, and decoding only the read-ins it has
+   not, with the cheapest repair plan for node.  st tells where the bytes
+   came from.  Returns the bytes read (short at the end of the file), or
+   -1. */
+
+typedef struct {
+  long node_bytes;              /* From the node file */
+  long cache_bytes;             /* From the repair in progress */
+  long decoded_bytes;           /* Decoded here ... */
+  int decodes;                  /* ... in this many read-ins */
+} ML_Read_Stats;
+
+long ml_degraded_read(int *matrix, char **fnames, int node, int readins, int layout,
+                      long off, long len, char *buf, ML_Read_Stats *st);
+
+void ml_repair_report(FILE *f, ML_Repair *rp, int blocksize, int readins, long actual);
+void ml_repair_free(ML_Repair *rp);
+
+#endif
@@ -0,0 +1,1208 @@
+/* multilayer.c
+ * Shared routines for the multilayer code.  See multilayer.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "galois.h"
+#include "jerasure.h"
+#include "multilayer.h"
+
+#define talloc(type, num) (type *) malloc(sizeof(type)*(num))
+
+ML_Layer ml_layers[ML_LAYERS] = {
+  {  0,  1, 1, 20 },
+  {  2,  3, 2, 18 },
+  {  4,  5, 2, 21 },
+  {  6,  7, 2, 16 },
+  {  8,  9, 4, 25 },
+  { 10, 11, 4, 13 },
+  { 12, 13, 4, 54 },
+};
+
+int ml_check_params(int k, int m, int w)
+{
+  if (k != ML_K || m != ML_M || w != ML_W) {
+    fprintf(stderr, "multilayer code needs k=%d m=%d w=%d, got k=%d m=%d w=%d\n",
+            ML_K, ML_M, ML_W, k, m, w);
+    return -1;
+  }
+  return 0;
+}
+
+int *ml_coding_matrix(int k, int m, int w)
+{
+  int *matrix;
+  int i, j, p;
+
+  matrix = talloc(int, k*m);
+  if (matrix == NULL) return NULL;
+
+  for (j = 0; j < k; j++) {
+    p = j+1;
+    matrix[j] = 1;
+    for (i = 1; i < m; i++) {
+      matrix[i*k+j] = galois_single_multiply(matrix[(i-1)*k+j], p, w);
+    }
+  }
+  return matrix;
+}
+
+/* X+Y = (1+e)A, then B = Y + eA. */
+
+void ml_uncouple_region(char *x, char *y, int e, int size)
+{
+  galois_region_xor(y, x, size);
+  galois_w08_region_multiply(x, galois_single_divide(1, e^1, ML_W), size, x, 0);
+  galois_w08_region_multiply(x, e, size, y, 1);
+}
+
+/* Y = eA + B, then X = (1+e)A + Y = A + B. */
+
+void ml_couple_region(char *x, char *y, int e, int size)
+{
+  galois_w08_region_multiply(x, e, size, y, 1);
+  galois_w08_region_multiply(x, e^1, size, x, 0);
+  galois_region_xor(y, x, size);
+}
+
+/* Decoding matrices made so far, k ids then k*k entries, by erased set
+   (bit i = node i).  The sub-stripes of a repair solve with a few erased
+   sets, and the same sets come back from plan to plan, so each is inverted
+   once a process.  They hold for the coding matrix of the first solve
+   planned; any other matrix is not memoized. */
+
+static struct {
+  int matrix[ML_M*ML_K];
+  int set;
+  int *dm[1 << ML_NODES];
+  char decodable[1 << ML_NODES];  /* 1 yes, 2 no, 0 not known */
+  pthread_mutex_t lock;
+} decoding = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int decoding_matrix(int *matrix, int *erased, int *dm, int *dm_ids)
+{
+  int *memo;
+  int i, key, same;
+
+  key = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    if (erased[i]) key |= (1 << i);
+  }
+  pthread_mutex_lock(&decoding.lock);
+  if (!decoding.set) {
+    memcpy(decoding.matrix, matrix, sizeof(decoding.matrix));
+    decoding.set = 1;
+  }
+  same = (memcmp(decoding.matrix, matrix, sizeof(decoding.matrix)) == 0);
+  memo = same ? decoding.dm[key] : NULL;
+  if (memo != NULL) {
+    memcpy(dm_ids, memo, sizeof(int)*ML_K);
+    memcpy(dm, memo+ML_K, sizeof(int)*ML_K*ML_K);
+  }
+  pthread_mutex_unlock(&decoding.lock);
+  if (memo != NULL) return 0;
+
+  if (jerasure_make_decoding_matrix(ML_K, ML_M, ML_W, matrix, erased, dm, dm_ids) < 0) return -1;
+  memo = same ? talloc(int, ML_K+ML_K*ML_K) : NULL;
+  if (memo == NULL) return 0;
+  memcpy(memo, dm_ids, sizeof(int)*ML_K);
+  memcpy(memo+ML_K, dm, sizeof(int)*ML_K*ML_K);
+  pthread_mutex_lock(&decoding.lock);
+  if (decoding.dm[key] == NULL) {
+    decoding.dm[key] = memo;
+    memo = NULL;
+  }
+  pthread_mutex_unlock(&decoding.lock);
+  free(memo);
+  return 0;
+}
+
+/* rows: parity rows the solve may read.  The decoding matrix is made from
+   the surviving data of the sub-stripe plus exactly those rows. */
+
+static int plan_add_solve(ML_Plan *plan, int *matrix, int sub, int mask, int rows)
+{
+  ML_Op *op;
+  int erased[ML_NODES];
+  int i, data_lost;
+
+  data_lost = 0;
+  for (i = 0; i < ML_K; i++) {
+    erased[i] = (mask >> i) & 1;
+    if (erased[i]) data_lost = 1;
+  }
+  for (i = 0; i < ML_M; i++) erased[ML_K+i] = !((rows >> i) & 1);
+  if (plan->nops == ML_MAX_OPS) return -1;
+
+  op = plan->ops + plan->nops;
+  op->type = ML_SOLVE;
+  op->sub = sub;
+  op->mask = mask;
+  op->dm = NULL;
+  if (data_lost) {
+    op->dm = talloc(int, ML_K*ML_K);
+    if (op->dm == NULL) return -1;
+    if (decoding_matrix(matrix, erased, op->dm, op->dm_ids) < 0) {
+      free(op->dm);
+      op->dm = NULL;
+      return -1;
+    }
+  }
+  plan->nops++;
+  return 0;
+}
+
+/* type is ML_UNCOUPLE or ML_COUPLE. */
+
+static int plan_add_pair(ML_Plan *plan, int type, int layer, int a)
+{
+  ML_Op *op;
+
+  if (plan->nops == ML_MAX_OPS) return -1;
+  op = plan->ops + plan->nops;
+  op->type = type;
+  op->layer = layer;
+  op->sub = a;
+  op->dm = NULL;
+  plan->nops++;
+  return 0;
+}
+
+static int plan_add_cell(ML_Plan *plan, int type, int dst, int src, int coef)
+{
+  ML_Op *op;
+
+  if (plan->nops == ML_MAX_OPS) return -1;
+  op = plan->ops + plan->nops;
+  op->type = type;
+  op->dst = dst;
+  op->src = src;
+  op->coef = coef;
+  op->dm = NULL;
+  plan->nops++;
+  return 0;
+}
+
+/* Planner state for ml_plan_decode().  A cell is known once its uncoupled
+   symbol sits in its buffer.  Coupled cells remember their layer and the
+   lower sub-stripe a of their pair. */
+
+typedef struct {
+  ML_Plan *plan;
+  int *matrix;
+  int erased[ML_NODES];
+  int known[ML_SUBS*ML_NODES];
+  int layer[ML_SUBS*ML_NODES];
+  int low[ML_SUBS*ML_NODES];
+} Planner;
+
+static int hi_cell(Planner *p, int c)
+{
+  return ML_CELL(p->low[c], ml_layers[p->layer[c]].hi);
+}
+
+static int lo_cell(Planner *p, int c)
+{
+  return ML_CELL(p->low[c]+ml_layers[p->layer[c]].stride, ml_layers[p->layer[c]].lo);
+}
+
+static int partner(Planner *p, int c)
+{
+  return (hi_cell(p, c) == c) ? lo_cell(p, c) : hi_cell(p, c);
+}
+
+static int lost(Planner *p, int c)
+{
+  return p->erased[ML_CELL_NODE(c)];
+}
+
+/* Coupled with both nodes alive: known after an uncouple. */
+
+static int uncouplable(Planner *p, int c)
+{
+  return p->layer[c] >= 0 && !lost(p, c) && !lost(p, partner(p, c));
+}
+
+/* Coupled with exactly one node lost. */
+
+static int half(Planner *p, int c)
+{
+  return p->layer[c] >= 0 && lost(p, c) != lost(p, partner(p, c));
+}
+
+static int avail(Planner *p, int c)
+{
+  return p->known[c] || uncouplable(p, c);
+}
+
+static int need(Planner *p, int c)
+{
+  if (p->known[c]) return 0;
+  if (!uncouplable(p, c)) return -1;
+  if (plan_add_pair(p->plan, ML_UNCOUPLE, p->layer[c], p->low[c]) < 0) return -1;
+  p->known[hi_cell(p, c)] = 1;
+  p->known[lo_cell(p, c)] = 1;
+  return 0;
+}
+
+/* Picks |D| readable parity rows of sub-stripe t, preferring rows whose cells
+   need no uncoupling, for which the decoding matrix exists.  Returns the row
+   mask, or -1. */
+
+static int choose_rows(Planner *p, int t, int dmask, int nd)
+{
+  int erased[ML_NODES];
+  int dm[ML_K*ML_K], ids[ML_K];
+  int rows, r, n, cost, best, bestcost, i;
+
+  best = -1;
+  bestcost = ML_M+1;
+  for (rows = 0; rows < (1 << ML_M); rows++) {
+    n = 0;
+    cost = 0;
+    for (r = 0; r < ML_M; r++) {
+      if (!((rows >> r) & 1)) continue;
+      if (!avail(p, ML_CELL(t, ML_K+r))) break;
+      n++;
+      if (!p->known[ML_CELL(t, ML_K+r)]) cost++;
+    }
+    if (r < ML_M || n != nd || cost >= bestcost) continue;
+    for (i = 0; i < ML_K; i++) erased[i] = (dmask >> i) & 1;
+    for (r = 0; r < ML_M; r++) erased[ML_K+r] = !((rows >> r) & 1);
+    if (jerasure_make_decoding_matrix(ML_K, ML_M, ML_W, p->matrix, erased, dm, ids) < 0) continue;
+    best = rows;
+    bestcost = cost;
+  }
+  return best;
+}
+
+/* After the cells of mask in sub-stripe t are solved, the lost half of each
+   pair with one lost node follows from the stored cell of the survivor.  When
+   the survivor's own cell is solved its stored value was first saved into
+   the lost partner's buffer. */
+
+static int derive(Planner *p, int t, int mask)
+{
+  ML_Layer *l;
+  int i, c, h, o;
+
+  for (i = 0; i < ML_NODES; i++) {
+    if (!((mask >> i) & 1)) continue;
+    c = ML_CELL(t, i);
+    if (!half(p, c) || p->known[partner(p, c)]) continue;
+    l = ml_layers + p->layer[c];
+    h = hi_cell(p, c);
+    o = lo_cell(p, c);
+    if (c == o) {
+      if (plan_add_cell(p->plan, ML_XOR, h, o, 0) < 0) return -1;
+      if (lost(p, h) && plan_add_cell(p->plan, ML_SCALE, h, 0, galois_single_divide(1, l->e, ML_W)) < 0) return -1;
+    } else if (lost(p, c)) {
+      if (plan_add_cell(p->plan, ML_MADD, o, h, l->e) < 0) return -1;
+    } else {
+      if (plan_add_cell(p->plan, ML_XOR, o, h, 0) < 0) return -1;
+    }
+    p->known[partner(p, c)] = 1;
+  }
+  return 0;
+}
+
+static int solve(Planner *p, int t, int dmask, int rows)
+{
+  int i, c, mask;
+
+  mask = dmask;
+  for (i = 0; i < ML_K; i++) {
+    if (!((dmask >> i) & 1) && need(p, ML_CELL(t, i)) < 0) return -1;
+  }
+  for (i = 0; i < ML_M; i++) {
+    c = ML_CELL(t, ML_K+i);
+    if ((rows >> i) & 1) {
+      if (need(p, c) < 0) return -1;
+    } else if (!avail(p, c) && half(p, c) && !p->known[partner(p, c)]) {
+      mask |= (1 << (ML_K+i));
+    }
+  }
+  for (i = 0; i < ML_NODES; i++) {
+    c = ML_CELL(t, i);
+    if (((mask >> i) & 1) && !lost(p, c) && half(p, c) && !p->known[partner(p, c)]) {
+      if (plan_add_cell(p->plan, ML_COPY, partner(p, c), c, 0) < 0) return -1;
+    }
+  }
+  if (plan_add_solve(p->plan, p->matrix, t, mask, rows) < 0) return -1;
+  for (i = 0; i < ML_NODES; i++) {
+    if ((mask >> i) & 1) p->known[ML_CELL(t, i)] = 1;
+  }
+  return derive(p, t, mask);
+}
+
+/* The equation of stored cell c over the uncoupled symbols. */
+
+static void stored_row(Planner *p, int c, int *row)
+{
+  int h, o;
+
+  if (p->layer[c] < 0) {
+    row[c] = 1;
+    return;
+  }
+  h = hi_cell(p, c);
+  o = lo_cell(p, c);
+  row[h] = (c == h) ? 1 : ml_layers[p->layer[c]].e;
+  row[o] = 1;
+}
+
+/* Solves the stripe as one linear system in the ML_SUBS*ML_NODES uncoupled
+   symbols, with one equation per stored cell that is known and the parity
+   equations of every sub-stripe.  targets holds ntargets rows of symbol
+   coefficients; each is rewritten as a combination of the known stored cells
+   into the matching row of coefs.  Returns -1 if a target is not determined
+   by what is known. */
+
+static int solve_system(Planner *p, int *known, int ntargets, int *targets, int *coefs)
+{
+  int *a, *row, *tmp, *pivot;
+  int n, width, nrows, rank, r, c, j, t, q, piv, x, rv;
+
+  n = ML_SUBS*ML_NODES;
+  width = 2*n;
+  a = talloc(int, (n+ML_SUBS*ML_M)*width);
+  tmp = talloc(int, width);
+  pivot = talloc(int, n+ML_SUBS*ML_M);
+  rv = -1;
+  if (a == NULL || tmp == NULL || pivot == NULL) goto done;
+  memset(a, 0, sizeof(int)*(n+ML_SUBS*ML_M)*width);
+
+  nrows = 0;
+  for (c = 0; c < n; c++) {
+    if (!known[c]) continue;
+    row = a + nrows*width;
+    stored_row(p, c, row);
+    row[n+c] = 1;
+    nrows++;
+  }
+  for (t = 0; t < ML_SUBS; t++) {
+    for (r = 0; r < ML_M; r++) {
+      row = a + nrows*width;
+      for (j = 0; j < ML_K; j++) row[ML_CELL(t, j)] = p->matrix[r*ML_K+j];
+      row[ML_CELL(t, ML_K+r)] = 1;
+      nrows++;
+    }
+  }
+
+  rank = 0;
+  for (c = 0; c < n && rank < nrows; c++) {
+    for (piv = rank; piv < nrows && a[piv*width+c] == 0; piv++) ;
+    if (piv == nrows) continue;
+    if (piv != rank) {
+      memcpy(tmp, a+piv*width, sizeof(int)*width);
+      memcpy(a+piv*width, a+rank*width, sizeof(int)*width);
+      memcpy(a+rank*width, tmp, sizeof(int)*width);
+    }
+    row = a + rank*width;
+    x = galois_single_divide(1, row[c], ML_W);
+    for (j = 0; j < width; j++) row[j] = galois_single_multiply(row[j], x, ML_W);
+    for (r = 0; r < nrows; r++) {
+      x = a[r*width+c];
+      if (r == rank || x == 0) continue;
+      for (j = 0; j < width; j++) a[r*width+j] ^= galois_single_multiply(row[j], x, ML_W);
+    }
+    pivot[rank++] = c;
+  }
+
+  for (q = 0; q < ntargets; q++) {
+    memcpy(tmp, targets+q*n, sizeof(int)*n);
+    memset(tmp+n, 0, sizeof(int)*n);
+    for (r = 0; r < rank; r++) {
+      x = tmp[pivot[r]];
+      if (x == 0) continue;
+      row = a + r*width;
+      for (j = 0; j < width; j++) tmp[j] ^= galois_single_multiply(row[j], x, ML_W);
+    }
+    for (j = 0; j < n && tmp[j] == 0; j++) ;
+    if (j < n) goto done;
+    memcpy(coefs+q*n, tmp+n, sizeof(int)*n);
+  }
+  rv = 0;
+
+done:
+  free(a);
+  free(tmp);
+  free(pivot);
+  return rv;
+}
+
+/* Emits an ML_COMBINE op for each target cell, coefs as from solve_system(). */
+
+static int plan_combines(Planner *p, int ntargets, int *cells, int *coefs)
+{
+  ML_Op *op;
+  int q, n;
+
+  n = ML_SUBS*ML_NODES;
+  for (q = 0; q < ntargets; q++) {
+    if (plan_add_cell(p->plan, ML_COMBINE, cells[q], 0, 0) < 0) return -1;
+    op = p->plan->ops + p->plan->nops-1;
+    op->dm = talloc(int, n);
+    if (op->dm == NULL) return -1;
+    memcpy(op->dm, coefs+q*n, sizeof(int)*n);
+  }
+  return 0;
+}
+
+/* Fallback for patterns the sub-stripe solves cannot untangle: each lost
+   data symbol becomes an ML_COMBINE of the stored cells from a solve of the
+   whole stripe; the survivors of the coupled data pairs follow from their
+   partners. */
+
+static int plan_linear(Planner *p)
+{
+  ML_Layer *l;
+  int *known, *targets, *coefs, *cells;
+  int n, nt, c, h, o, rv;
+
+  n = ML_SUBS*ML_NODES;
+  known = talloc(int, n);
+  cells = talloc(int, n);
+  targets = talloc(int, n*n);
+  coefs = talloc(int, n*n);
+  rv = -1;
+  if (known == NULL || cells == NULL || targets == NULL || coefs == NULL) goto done;
+  memset(targets, 0, sizeof(int)*n*n);
+
+  nt = 0;
+  for (c = 0; c < n; c++) {
+    known[c] = !lost(p, c);
+    if (lost(p, c) && ML_CELL_NODE(c) < ML_K) {
+      targets[nt*n+c] = 1;
+      cells[nt++] = c;
+    }
+  }
+  if (solve_system(p, known, nt, targets, coefs) < 0) goto done;
+  if (plan_combines(p, nt, cells, coefs) < 0) goto done;
+
+  for (c = 0; c < n; c++) {
+    if (lost(p, c) || ML_CELL_NODE(c) >= ML_K || p->layer[c] < 0) continue;
+    l = ml_layers + p->layer[c];
+    h = hi_cell(p, c);
+    o = lo_cell(p, c);
+    if (uncouplable(p, c)) {
+      if (c == h && plan_add_pair(p->plan, ML_UNCOUPLE, p->layer[c], p->low[c]) < 0) goto done;
+    } else if (c == h) {
+      if (plan_add_cell(p->plan, ML_XOR, h, o, 0) < 0) goto done;
+    } else {
+      if (plan_add_cell(p->plan, ML_MADD, o, h, l->e) < 0) goto done;
+    }
+  }
+  rv = 0;
+
+done:
+  free(known);
+  free(cells);
+  free(targets);
+  free(coefs);
+  if (rv < 0) ml_plan_free(p->plan);
+  return rv;
+}
+
+static void planner_init(Planner *p, ML_Plan *plan, int *matrix, int *erased)
+{
+  ML_Layer *l;
+  int i, a, c;
+
+  plan->nops = 0;
+  p->plan = plan;
+  p->matrix = matrix;
+  for (i = 0; i < ML_NODES; i++) p->erased[i] = (erased[i] != 0);
+  for (c = 0; c < ML_SUBS*ML_NODES; c++) p->layer[c] = -1;
+  for (i = 0; i < ML_LAYERS; i++) {
+    l = ml_layers + i;
+    for (a = 0; a < ML_SUBS; a++) {
+      if (a & l->stride) continue;
+      p->layer[ML_CELL(a, l->hi)] = i;
+      p->low[ML_CELL(a, l->hi)] = a;
+      p->layer[ML_CELL(a+l->stride, l->lo)] = i;
+      p->low[ML_CELL(a+l->stride, l->lo)] = a;
+    }
+  }
+  for (c = 0; c < ML_SUBS*ML_NODES; c++) {
+    p->known[c] = (p->layer[c] < 0 && !lost(p, c));
+  }
+}
+
+/* Sub-stripe solves are picked greedily: the solvable sub-stripe with the
+   most unknown data symbols goes first, since its pairs settle the most
+   symbols elsewhere.  When no sub-stripe is solvable, a parity symbol whose
+   partner is still open is re-encoded from a fully known sub-stripe, and
+   failing that the whole stripe is solved by plan_linear(). */
+
+int ml_plan_decode(ML_Plan *plan, int *matrix, int *erased)
+{
+  Planner p;
+  int t, i, c, nd, dmask, rows;
+  int best, bestnd, bestrows, open, progress;
+
+  planner_init(&p, plan, matrix, erased);
+
+  while (1) {
+    best = -1;
+    bestnd = 0;
+    bestrows = 0;
+    open = 0;
+    for (t = 0; t < ML_SUBS; t++) {
+      nd = 0;
+      dmask = 0;
+      for (i = 0; i < ML_K; i++) {
+        if (!avail(&p, ML_CELL(t, i))) {
+          nd++;
+          dmask |= (1 << i);
+        }
+      }
+      if (nd == 0) continue;
+      open = 1;
+      if (nd <= bestnd) continue;
+      rows = choose_rows(&p, t, dmask, nd);
+      if (rows < 0) continue;
+      best = t;
+      bestnd = nd;
+      bestrows = rows;
+    }
+    if (!open) break;
+
+    if (best >= 0) {
+      dmask = 0;
+      for (i = 0; i < ML_K; i++) {
+        if (!avail(&p, ML_CELL(best, i))) dmask |= (1 << i);
+      }
+      if (solve(&p, best, dmask, bestrows) < 0) goto fail;
+      continue;
+    }
+
+    progress = 0;
+    for (t = 0; t < ML_SUBS && !progress; t++) {
+      for (i = 0; i < ML_K; i++) {
+        if (!avail(&p, ML_CELL(t, i))) break;
+      }
+      if (i < ML_K) continue;
+      for (i = ML_K; i < ML_NODES; i++) {
+        c = ML_CELL(t, i);
+        if (!avail(&p, c) && half(&p, c) && !p.known[partner(&p, c)]) progress = 1;
+      }
+      if (progress && solve(&p, t, 0, 0) < 0) goto fail;
+    }
+    if (!progress) goto fail;
+  }
+
+  for (t = 0; t < ML_SUBS; t++) {
+    for (i = 0; i < ML_K; i++) {
+      if (need(&p, ML_CELL(t, i)) < 0) goto fail;
+    }
+  }
+  return 0;
+
+fail:
+  ml_plan_free(plan);
+  return plan_linear(&p);
+}
+
+int ml_plan_decodable(int *matrix, int *erased)
+{
+  ML_Plan probe;
+  int i, key, n, same, rv;
+
+  key = n = 0;
+  for (i = 0; i < ML_NODES; i++) {
+    if (erased[i]) {
+      key |= (1 << i);
+      n++;
+    }
+  }
+  if (n > ML_M) return 0;
+  pthread_mutex_lock(&decoding.lock);
+  if (!decoding.set) {
+    memcpy(decoding.matrix, matrix, sizeof(decoding.matrix));
+    decoding.set = 1;
+  }
+  same = (memcmp(decoding.matrix, matrix, sizeof(decoding.matrix)) == 0);
+  rv = same ? decoding.decodable[key] : 0;
+  pthread_mutex_unlock(&decoding.lock);
+  if (rv != 0) return (rv == 1);
+
+  rv = (ml_plan_decode(&probe, matrix, erased) == 0);
+  if (rv) ml_plan_free(&probe);
+  if (same) {
+    pthread_mutex_lock(&decoding.lock);
+    decoding.decodable[key] = rv ? 1 : 2;
+    pthread_mutex_unlock(&decoding.lock);
+  }
+  return rv;
+}
+
+int ml_plan_rebuild(ML_Plan *plan, int *matrix, int *erased)
+{
+  ML_Layer *l;
+  int t, i, a, pmask;
+
+  if (ml_plan_decode(plan, matrix, erased) < 0) return -1;
+
+  pmask = 0;
+  for (i = 0; i < ML_LAYERS; i++) {
+    l = ml_layers + i;
+    if (l->lo >= ML_K && (erased[l->lo] || erased[l->hi])) pmask |= (1 << l->lo) | (1 << l->hi);
+  }
+  for (t = 0; t < ML_SUBS && pmask != 0; t++) {
+    if (plan_add_solve(plan, matrix, t, pmask, 0) < 0) goto fail;
+  }
+  for (i = 0; i < ML_LAYERS; i++) {
+    l = ml_layers + i;
+    if (!erased[l->lo] && !erased[l->hi]) continue;
+    for (a = 0; a < ML_SUBS; a++) {
+      if (a & l->stride) continue;
+      if (plan_add_pair(plan, ML_COUPLE, i, a) < 0) goto fail;
+    }
+  }
+  return 0;
+
+fail:
+  ml_plan_free(plan);
+  return -1;
+}
+
+/* Nodes whose cells of the repair sub-stripes must be read when the parity
+   rows in rows are used: the data outside ucol, the partner of f and every
+   node coupled inside the repair sub-stripes to one of those. */
+
+static int repair_helpers(int f, int ucol, int rows)
+{
+  ML_Layer *l;
+  int need, i, lf;
+
+  for (lf = 0; ml_layers[lf].lo != f && ml_layers[lf].hi != f; lf++) ;
+  need = ((1 << ML_K)-1) & ~ucol;
+  need |= rows << ML_K;
+  need |= 1 << (ml_layers[lf].lo ^ ml_layers[lf].hi ^ f);
+  for (i = 0; i < ML_LAYERS; i++) {
+    l = ml_layers + i;
+    if (l->stride == ml_layers[lf].stride) continue;
+    if (need & ((1 << l->lo) | (1 << l->hi))) need |= (1 << l->lo) | (1 << l->hi);
+  }
+  return need & ~(1 << f);
+}
+
+/* Single-node repair from half of the sub-stripes.  With f in the layer of
+   stride s, the repair sub-stripes are those whose bit s matches the side f
+   is on: f's cells there are uncoupled, every pair of another stride lies
+   wholly inside them, and the only other unknowns are the cells coupled out
+   of them by the layers of stride s.  One sub-stripe solve gives f's cell and
+   its partner's symbol, from which f's coupled cell in the other half
+   follows. */
+
+int ml_plan_repair(ML_Plan *plan, int *matrix, int f, int minimal, int *load, int *reads)
+{
+  Planner p;
+  ML_Layer *l, *lf;
+  int erased[ML_NODES], e[ML_NODES];
+  int dm[ML_K*ML_K], ids[ML_K];
+  int bit, ucol, dmask, nd, rows, r, nr, need, best, bestn, subs;
+  int hot, sum, besthot, bestsum;
+  int i, t, x, y, pf, mask;
+
+  for (i = 0; i < ML_NODES; i++) erased[i] = (i == f);
+  planner_init(&p, plan, matrix, erased);
+  for (i = 0; ml_layers[i].lo != f && ml_layers[i].hi != f; i++) ;
+  lf = ml_layers + i;
+  bit = (f == lf->hi) ? lf->stride : 0;
+  pf = lf->lo ^ lf->hi ^ f;
+
+  ucol = 1 << f;
+  for (i = 0; i < ML_LAYERS; i++) {
+    l = ml_layers + i;
+    if (l->stride == lf->stride) ucol |= 1 << (bit ? l->lo : l->hi);
+  }
+  dmask = ucol & ((1 << ML_K)-1);
+  for (nd = 0, i = 0; i < ML_K; i++) nd += (dmask >> i) & 1;
+
+  /* The parity rows: as many as unknown data columns, invertible, and
+     pulling in the least loaded helpers, then the fewest. */
+
+  best = -1;
+  bestn = ML_NODES+1;
+  besthot = bestsum = 0;
+  for (rows = 0; rows < (1 << ML_M); rows++) {
+    if ((rows << ML_K) & ucol) continue;
+    for (nr = 0, r = 0; r < ML_M; r++) nr += (rows >> r) & 1;
+    if (nr != nd) continue;
+    need = repair_helpers(f, ucol, rows);
+    nr = hot = sum = 0;
+    for (i = 0; i < ML_NODES; i++) {
+      if (!((need >> i) & 1)) continue;
+      nr++;
+      if (load == NULL) continue;
+      if (load[i] > hot) hot = load[i];
+      sum += load[i];
+    }
+    if (best >= 0 && (hot > besthot || (hot == besthot && (nr > bestn || (nr == bestn && sum >= bestsum))))) continue;
+    for (i = 0; i < ML_K; i++) e[i] = (dmask >> i) & 1;
+    for (r = 0; r < ML_M; r++) e[ML_K+r] = !((rows >> r) & 1);
+    if (jerasure_make_decoding_matrix(ML_K, ML_M, ML_W, matrix, e, dm, ids) < 0) continue;
+    best = rows;
+    bestn = nr;
+    besthot = hot;
+    bestsum = sum;
+  }
+  if (best < 0) return -1;
+  rows = best;
+  need = minimal ? repair_helpers(f, ucol, rows) : (((1 << ML_NODES)-1) & ~(1 << f));
+
+  subs = 0;
+  for (t = 0; t < ML_SUBS; t++) {
+    if ((t & lf->stride) == bit) subs |= 1 << t;
+  }
+  for (i = 0; i < ML_NODES; i++) reads[i] = ((need >> i) & 1) ? subs : 0;
+
+  /* Uncouple the pairs inside the repair sub-stripes: those the solve reads,
+     or every readable one when not minimal. */
+
+  for (i = 0; i < ML_LAYERS; i++) {
+    l = ml_layers + i;
+    if (l->stride == lf->stride || !((need >> l->lo) & 1) || !((need >> l->hi) & 1)) continue;
+    if (minimal && !((((1 << ML_K)-1) & ~ucol) & ((1 << l->lo) | (1 << l->hi))) &&
+        !((rows << ML_K) & ((1 << l->lo) | (1 << l->hi)))) continue;
+    for (t = 0; t < ML_SUBS; t++) {
+      if (!((subs >> t) & 1) || (t & l->stride)) continue;
+      if (plan_add_pair(plan, ML_UNCOUPLE, i, t) < 0) goto fail;
+    }
+  }
+
+  mask = dmask | (ucol & (((1 << f) | (1 << pf)) & ~((1 << ML_K)-1)));
+  for (t = 0; t < ML_SUBS; t++) {
+    if (!((subs >> t) & 1)) continue;
+    x = ML_CELL(bit ? t-lf->stride : t+lf->stride, f);
+    y = ML_CELL(t, pf);
+    if (plan_add_cell(plan, ML_COPY, x, y, 0) < 0) goto fail;
+    if (plan_add_solve(plan, matrix, t, mask, rows) < 0) goto fail;
+    if (f == lf->lo) {
+      if (plan_add_cell(plan, ML_XOR, x, y, 0) < 0) goto fail;
+      if (plan_add_cell(plan, ML_MADD, x, y, lf->e) < 0) goto fail;
+    } else {
+      if (plan_add_cell(plan, ML_XOR, x, y, 0) < 0) goto fail;
+      if (plan_add_cell(plan, ML_SCALE, x, 0, galois_single_divide(1, lf->e, ML_W)) < 0) goto fail;
+      if (plan_add_cell(plan, ML_XOR, x, y, 0) < 0) goto fail;
+    }
+  }
+  return 0;
+
+fail:
+  ml_plan_free(plan);
+  return -1;
+}
+
+int ml_plan_combine(ML_Plan *plan, int *matrix, int *erased, int *reads)
+{
+  Planner p;
+  int *known, *targets, *coefs, *cells;
+  int n, nt, c, rv;
+
+  planner_init(&p, plan, matrix, erased);
+  n = ML_SUBS*ML_NODES;
+  known = talloc(int, n);
+  cells = talloc(int, n);
+  targets = talloc(int, n*n);
+  coefs = talloc(int, n*n);
+  rv = -1;
+  if (known == NULL || cells == NULL || targets == NULL || coefs == NULL) goto done;
+  memset(targets, 0, sizeof(int)*n*n);
+
+  nt = 0;
+  for (c = 0; c < n; c++) {
+    known[c] = !erased[ML_CELL_NODE(c)] && ((reads[ML_CELL_NODE(c)] >> ML_CELL_SUB(c)) & 1);
+    if (erased[ML_CELL_NODE(c)]) {
+      stored_row(&p, c, targets+nt*n);
+      cells[nt++] = c;
+    }
+  }
+  if (solve_system(&p, known, nt, targets, coefs) < 0) goto done;
+  if (plan_combines(&p, nt, cells, coefs) < 0) goto done;
+  rv = 0;
+
+done:
+  free(known);
+  free(cells);
+  free(targets);
+  free(coefs);
+  if (rv < 0) ml_plan_free(plan);
+  return rv;
+}
+
+/* One op per line: type layer sub mask dst src coef, then for ML_SOLVE
+   with a matrix the k ids and k*k entries, for ML_COMBINE the nonzero
+   coefficients as count and cell:coef pairs. */
+
+int ml_plan_write(FILE *fp, ML_Plan *plan)
+{
+  ML_Op *op;
+  int i, j, n;
+
+  fprintf(fp, "%d\n", plan->nops);
+  for (i = 0; i < plan->nops; i++) {
+    op = plan->ops + i;
+    fprintf(fp, "%d %d %d %d %d %d %d", op->type, op->layer, op->sub, op->mask, op->dst, op->src, op->coef);
+    if (op->type == ML_SOLVE) {
+      fprintf(fp, " %d", op->dm != NULL);
+      if (op->dm != NULL) {
+        for (j = 0; j < ML_K; j++) fprintf(fp, " %d", op->dm_ids[j]);
+        for (j = 0; j < ML_K*ML_K; j++) fprintf(fp, " %d", op->dm[j]);
+      }
+    } else if (op->type == ML_COMBINE) {
+      for (n = 0, j = 0; j < ML_SUBS*ML_NODES; j++) n += (op->dm[j] != 0);
+      fprintf(fp, " %d", n);
+      for (j = 0; j < ML_SUBS*ML_NODES; j++) {
+        if (op->dm[j] != 0) fprintf(fp, " %d:%d", j, op->dm[j]);
+      }
+    }
+    fprintf(fp, "\n");
+  }
+  return ferror(fp) ? -1 : 0;
+}
+
+static int valid_cell(int c)
+{
+  return c >= 0 && c < ML_SUBS*ML_NODES;
+}
+
+int ml_plan_read(FILE *fp, ML_Plan *plan)
+{
+  ML_Op *op;
+  int i, j, n, c, x, nops;
+
+  plan->nops = 0;
+  if (fscanf(fp, "%d", &nops) != 1 || nops < 0 || nops > ML_MAX_OPS) return -1;
+  for (i = 0; i < nops; i++) {
+    op = plan->ops + i;
+    op->dm = NULL;
+    plan->nops = i+1;
+    if (fscanf(fp, "%d %d %d %d %d %d %d", &op->type, &op->layer, &op->sub, &op->mask, &op->dst,
+               &op->src, &op->coef) != 7) goto fail;
+    if (op->type < ML_UNCOUPLE || op->type > ML_COMBINE) goto fail;
+    switch (op->type) {
+      case ML_UNCOUPLE:
+      case ML_COUPLE:
+        if (op->layer < 0 || op->layer >= ML_LAYERS || op->sub < 0 ||
+            op->sub+ml_layers[op->layer].stride >= ML_SUBS) goto fail;
+        break;
+      case ML_SOLVE:
+        if (op->sub < 0 || op->sub >= ML_SUBS || fscanf(fp, "%d", &n) != 1) goto fail;
+        if (n == 0) break;
+        op->dm = talloc(int, ML_K*ML_K);
+        if (op->dm == NULL) goto fail;
+        for (j = 0; j < ML_K; j++) {
+          if (fscanf(fp, "%d", op->dm_ids+j) != 1 || op->dm_ids[j] < 0 || op->dm_ids[j] >= ML_NODES) goto fail;
+        }
+        for (j = 0; j < ML_K*ML_K; j++) {
+          if (fscanf(fp, "%d", op->dm+j) != 1) goto fail;
+        }
+        break;
+      case ML_COMBINE:
+        if (!valid_cell(op->dst) || fscanf(fp, "%d", &n) != 1) goto fail;
+        op->dm = talloc(int, ML_SUBS*ML_NODES);
+        if (op->dm == NULL) goto fail;
+        memset(op->dm, 0, sizeof(int)*ML_SUBS*ML_NODES);
+        for (j = 0; j < n; j++) {
+          if (fscanf(fp, "%d:%d", &c, &x) != 2 || !valid_cell(c)) goto fail;
+          op->dm[c] = x;
+        }
+        break;
+      default:
+        if (!valid_cell(op->dst) || (op->type != ML_SCALE && !valid_cell(op->src))) goto fail;
+        break;
+    }
+  }
+  return 0;
+
+fail:
+  ml_plan_free(plan);
+  return -1;
+}
+
+int ml_plan_copy(ML_Plan *dst, ML_Plan *src)
+{
+  int i, n;
+
+  memcpy(dst, src, sizeof(ML_Plan));
+  for (i = 0; i < src->nops; i++) {
+    if (src->ops[i].dm == NULL) continue;
+    n = (src->ops[i].type == ML_SOLVE) ? ML_K*ML_K : ML_SUBS*ML_NODES;
+    dst->ops[i].dm = talloc(int, n);
+    if (dst->ops[i].dm == NULL) {
+      dst->nops = i;
+      ml_plan_free(dst);
+      return -1;
+    }
+    memcpy(dst->ops[i].dm, src->ops[i].dm, sizeof(int)*n);
+  }
+  return 0;
+}
+
+void ml_plan_free(ML_Plan *plan)
+{
+  int i;
+
+  for (i = 0; i < plan->nops; i++) {
+    if (plan->ops[i].dm != NULL) free(plan->ops[i].dm);
+    plan->ops[i].dm = NULL;
+  }
+  plan->nops = 0;
+}
+
+static void run_solve(ML_Op *op, int *matrix, char **nodes, int blocksize, int off, int size)
+{
+  char *data[ML_K];
+  char *coding[ML_M];
+  int i, base;
+
+  base = op->sub*blocksize + off;
+  for (i = 0; i < ML_K; i++) data[i] = nodes[i] + base;
+  for (i = 0; i < ML_M; i++) coding[i] = nodes[ML_K+i] + base;
+
+  for (i = 0; i < ML_K; i++) {
+    if (op->mask & (1 << i)) {
+      jerasure_matrix_dotprod(ML_K, ML_W, op->dm+(i*ML_K), op->dm_ids, i, data, coding, size);
+    }
+  }
+  for (i = 0; i < ML_M; i++) {
+    if (op->mask & (1 << (ML_K+i))) {
+      jerasure_matrix_dotprod(ML_K, ML_W, matrix+(i*ML_K), NULL, ML_K+i, data, coding, size);
+    }
+  }
+}
+
+static char *cell_ptr(char **nodes, int c, int blocksize, int off)
+{
+  return nodes[ML_CELL_NODE(c)] + ML_CELL_SUB(c)*blocksize + off;
+}
+
+static void run_combine(ML_Op *op, char **nodes, int blocksize, int off, int size)
+{
+  char *dst;
+  int c, first;
+
+  dst = cell_ptr(nodes, op->dst, blocksize, off);
+  first = 1;
+  for (c = 0; c < ML_SUBS*ML_NODES; c++) {
+    if (op->dm[c] == 0) continue;
+    if (op->dm[c] == 1) {
+      if (first) memcpy(dst, cell_ptr(nodes, c, blocksize, off), size);
+      else galois_region_xor(cell_ptr(nodes, c, blocksize, off), dst, size);
+    } else {
+      galois_w08_region_multiply(cell_ptr(nodes, c, blocksize, off), op->dm[c], size, dst, !first);
+    }
+    first = 0;
+  }
+  if (first) memset(dst, 0, size);
+}
+
+int ml_plan_run(ML_Plan *plan, int *matrix, char **nodes, int blocksize, int off, int size)
+{
+  ML_Op *op;
+  ML_Layer *l;
+  int i;
+
+  for (i = 0; i < plan->nops; i++) {
+    op = plan->ops + i;
+    switch (op->type) {
+      case ML_UNCOUPLE:
+        l = ml_layers + op->layer;
+        ml_uncouple_region(nodes[l->hi] + op->sub*blocksize + off,
+                           nodes[l->lo] + (op->sub+l->stride)*blocksize + off, l->e, size);
+        break;
+      case ML_COUPLE:
+        l = ml_layers + op->layer;
+        ml_couple_region(nodes[l->hi] + op->sub*blocksize + off,
+                         nodes[l->lo] + (op->sub+l->stride)*blocksize + off, l->e, size);
+        break;
+      case ML_SOLVE:
+        run_solve(op, matrix, nodes, blocksize, off, size);
+        break;
+      case ML_COPY:
+        memcpy(cell_ptr(nodes, op->dst, blocksize, off), cell_ptr(nodes, op->src, blocksize, off), size);
+        break;
+      case ML_XOR:
+        galois_region_xor(cell_ptr(nodes, op->src, blocksize, off), cell_ptr(nodes, op->dst, blocksize, off), size);
+        break;
+      case ML_MADD:
+        galois_w08_region_multiply(cell_ptr(nodes, op->src, blocksize, off), op->coef, size,
+                                   cell_ptr(nodes, op->dst, blocksize, off), 1);
+        break;
+      case ML_SCALE:
+        galois_w08_region_multiply(cell_ptr(nodes, op->dst, blocksize, off), op->coef, size,
+                                   cell_ptr(nodes, op->dst, blocksize, off), 0);
+        break;
+      case ML_COMBINE:
+        run_combine(op, nodes, blocksize, off, size);
+        break;
+      default:
+        return -1;
+    }
+  }
+  return 0;
+}
+
+int ml_decode_tiled(ML_Plan *plan, int *matrix, char **nodes, int blocksize, int tile, char **fdata)
+{
+  int off, size, t, i;
+
+  if (tile <= 0) tile = ML_TILE;
+  for (off = 0; off < blocksize; off += tile) {
+    size = (off+tile <= blocksize) ? tile : blocksize-off;
+    if (ml_plan_run(plan, matrix, nodes, blocksize, off, size) < 0) return -1;
+    if (fdata == NULL) continue;
+    for (t = 0; t < ML_SUBS; t++) {
+      for (i = 0; i < ML_K; i++) {
+        memcpy(fdata[t] + i*blocksize + off, nodes[i] + t*blocksize + off, size);
+      }
+    }
+  }
+  return 0;
+}
+
+/* Decodes one tile of the stored cells into scratch (ML_NODES buffers of
+   ML_SUBS*tile bytes), optionally scatters the data into fdata, then
+   re-encodes and re-couples the stripe and compares it with the stored cells
+   of every node not in skip[].  Returns 1 on a mismatch. */
+
+static int check_tile(ML_Plan *plan, int *matrix, char **nodes, int blocksize, int off, int size,
+                      char **scratch, int tile, int *skip, char **fdata)
+{
+  char *data[ML_K], *coding[ML_M];
+  ML_Layer *l;
+  int t, i, a;
+
+  for (i = 0; i < ML_NODES; i++) {
+    if (skip[i]) continue;
+    for (t = 0; t < ML_SUBS; t++) memcpy(scratch[i] + t*tile, nodes[i] + t*blocksize + off, size);
+  }
+  if (ml_plan_run(plan, matrix, scratch, tile, 0, size) < 0) return -1;
+  if (fdata != NULL) {
+    for (t = 0; t < ML_SUBS; t++) {
+      for (i = 0; i < ML_K; i++) memcpy(fdata[t] + i*blocksize + off, scratch[i] + t*tile, size);
+    }
+  }
+
+  for (t = 0; t < ML_SUBS; t++) {
+    for (i = 0; i < ML_K; i++) data[i] = scratch[i] + t*tile;
+    for (i = 0; i < ML_M; i++) coding[i] = scratch[ML_K+i] + t*tile;
+    jerasure_matrix_encode(ML_K, ML_M, ML_W, matrix, data, coding, size);
+  }
+  for (i = 0; i < ML_LAYERS; i++) {
+    l = ml_layers + i;
+    for (a = 0; a < ML_SUBS; a++) {
+      if (a & l->stride) continue;
+      ml_couple_region(scratch[l->hi] + a*tile, scratch[l->lo] + (a+l->stride)*tile, l->e, size);
+    }
+  }
+
+  for (i = 0; i < ML_NODES; i++) {
+    if (skip[i]) continue;
+    for (t = 0; t < ML_SUBS; t++) {
+      if (memcmp(scratch[i] + t*tile, nodes[i] + t*blocksize + off, size) != 0) return 1;
+    }
+  }
+  return 0;
+}
+
+static char **alloc_scratch(int tile)
+{
+  char **scratch;
+  int i;
+
+  scratch = talloc(char *, ML_NODES);
+  if (scratch == NULL) return NULL;
+  scratch[0] = talloc(char, ML_NODES*ML_SUBS*tile);
+  if (scratch[0] == NULL) {
+    free(scratch);
+    return NULL;
+  }
+  for (i = 1; i < ML_NODES; i++) scratch[i] = scratch[0] + i*ML_SUBS*tile;
+  return scratch;
+}
+
+static void free_scratch(char **scratch)
+{
+  free(scratch[0]);
+  free(scratch);
+}
+
+int ml_decode_verified(ML_Plan *plan, int *matrix, char **nodes, int blocksize, int tile,
+                       int *erased, char **fdata)
+{
+  char **scratch;
+  int off, size, rv;
+
+  if (tile <= 0) tile = ML_TILE;
+  scratch = alloc_scratch(tile);
+  if (scratch == NULL) return -1;
+  rv = 0;
+  for (off = 0; off < blocksize && rv == 0; off += tile) {
+    size = (off+tile <= blocksize) ? tile : blocksize-off;
+    rv = check_tile(plan, matrix, nodes, blocksize, off, size, scratch, tile, erased, fdata);
+  }
+  free_scratch(scratch);
+  return rv;
+}
+
+/* A set of suspects explains the stripe if decoding with the suspects erased
+   reproduces every other stored cell.  While at least one parity is left
+   over, only the true set can do that when no more than (m-|erased|)/2 nodes
+   are corrupt. */
+
+static int suspects_fit(int *matrix, char **nodes, int blocksize, int tile, char **scratch, int *skip)
+{
+  ML_Plan plan;
+  int off, size, rv;
+
+  if (ml_plan_decode(&plan, matrix, skip) < 0) return 0;
+  rv = 0;
+  for (off = 0; off < blocksize && rv == 0; off += tile) {
+    size = (off+tile <= blocksize) ? tile : blocksize-off;
+    rv = check_tile(&plan, matrix, nodes, blocksize, off, size, scratch, tile, skip, NULL);
+  }
+  ml_plan_free(&plan);
+  return (rv == 0);
+}
+
+int ml_locate_corrupt(int *matrix, char **nodes, int blocksize, int tile, int *erased)
+{
+  char **scratch;
+  int skip[ML_NODES];
+  int nerased, nbad, a, b, i;
+
+  if (tile <= 0) tile = ML_TILE;
+  nerased = 0;
+  for (i = 0; i < ML_NODES; i++) nerased += (erased[i] != 0);
+  scratch = alloc_scratch(tile);
+  if (scratch == NULL) return -1;
+
+  for (nbad = 1; nbad <= 2 && nerased+nbad < ML_M; nbad++) {
+    for (a = 0; a < ML_NODES; a++) {
+      if (erased[a]) continue;
+      for (b = (nbad == 1) ? a : a+1; b < ML_NODES; b++) {
+        if (erased[b]) continue;
+        for (i = 0; i < ML_NODES; i++) skip[i] = (erased[i] != 0);
+        skip[a] = 1;
+        skip[b] = 1;
+        if (suspects_fit(matrix, nodes, blocksize, tile, scratch, skip)) {
+          free_scratch(scratch);
+          erased[a] = 1;
+          erased[b] = 1;
+          return nbad;
+        }
+        if (nbad == 1) break;
+      }
+    }
+  }
+  free_scratch(scratch);
+  return -1;
+}
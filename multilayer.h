@@ -0,0 +1,163 @@
+/* multilayer.h
+ * Shared routines for the multilayer code of encoder.c, decoder.c and the
+ * repair programs.
+
+   A stripe holds ML_SUBS sub-stripes of a (k=10, m=4) Reed-Solomon code
+   over GF(2^8).  Pairs of nodes are coupled across sub-stripes: for layer l
+   with node pair (lo, hi) and stride s, and every sub-stripe a whose bit s
+   is clear, the cells (a, hi) and (a+s, lo) are stored as
+
+       X = A + B          at (a, hi)
+       Y = e*A + B        at (a+s, lo)
+
+   where A and B are the uncoupled Reed-Solomon symbols of those cells.
+   All other cells are stored uncoupled.
+
+   Nodes are numbered 0..k-1 for the data files (_kNN) and k..k+m-1 for the
+   coding files (_mNN).  A node file holds ML_SUBS cells of blocksize bytes
+   per read-in, cell t of node i at offset t*blocksize.
+ */
+
+#ifndef _MULTILAYER_H
+#define _MULTILAYER_H
+
+#include <stdio.h>
+
+#define ML_K 10
+#define ML_M 4
+#define ML_W 8
+#define ML_SUBS 8
+#define ML_NODES (ML_K+ML_M)
+#define ML_LAYERS 7
+
+#define ML_TILE 2048            /* Default column tile of the fused decode */
+#define ML_MAX_OPS 256
+
+typedef struct {
+  int lo;                       /* Node whose coupled cell is in sub-stripe a+stride */
+  int hi;                       /* Node whose coupled cell is in sub-stripe a */
+  int stride;
+  int e;                        /* Coupling coefficient */
+} ML_Layer;
+
+extern ML_Layer ml_layers[ML_LAYERS];
+
+enum ML_Op_Type { ML_UNCOUPLE, ML_COUPLE, ML_SOLVE, ML_COPY, ML_XOR, ML_MADD, ML_SCALE, ML_COMBINE };
+
+/* Cells are named ML_CELL(sub-stripe, node). */
+
+#define ML_CELL(t, i) ((t)*ML_NODES+(i))
+#define ML_CELL_SUB(c) ((c)/ML_NODES)
+#define ML_CELL_NODE(c) ((c)%ML_NODES)
+
+typedef struct {
+  int type;
+  int layer;                    /* ML_UNCOUPLE, ML_COUPLE: coupled pair of this layer ... */
+  int sub;                      /* ... starting at sub-stripe a, or the sub-stripe to solve */
+  int mask;                     /* ML_SOLVE: nodes to reconstruct, bit i = node i */
+  int *dm;                      /* ML_SOLVE: k*k decoding matrix, NULL if no data node is lost;
+                                   ML_COMBINE: coefficient of every stored cell, dst = sum */
+  int dm_ids[ML_K];
+  int dst, src;                 /* Cell ops: dst = src, dst ^= src, dst ^= coef*src, dst *= coef */
+  int coef;
+} ML_Op;
+
+typedef struct {
+  int nops;
+  ML_Op ops[ML_MAX_OPS];
+} ML_Plan;
+
+/* The 4 x 10 Vandermonde coding matrix with rows 1, p, p^2, p^3, p = i+1. */
+
+int *ml_coding_matrix(int k, int m, int w);
+int ml_check_params(int k, int m, int w);
+
+/* In-place conversion of one coupled pair: x is the cell (a, hi), y the cell
+   (a+stride, lo). */
+
+void ml_uncouple_region(char *x, char *y, int e, int size);
+void ml_couple_region(char *x, char *y, int e, int size);
+
+/* Plans are built once per erasure pattern and then run over column tiles.
+   nodes[i] points at the ML_SUBS*blocksize buffer of node i, lost nodes
+   included.  ml_plan_run() executes every op on bytes [off, off+size) of each
+   cell.
+
+   ml_plan_decode() plans a decode for the erased[] nodes that leaves the
+   uncoupled data symbols in the data node buffers.  Only the pairs and the
+   sub-stripes the erasures require are touched: pairs with one lost node are
+   resolved from a single sub-stripe solve, parity pairs are uncoupled only
+   when a solve reads that parity row, and sub-stripes whose lost symbols
+   all follow from a coupled partner are not solved at all.  Patterns where
+   no sub-stripe can be solved on its own fall back to ML_COMBINE ops from a
+   solve of the whole stripe.  Returns -1 if the pattern cannot be decoded. */
+
+int ml_plan_decode(ML_Plan *plan, int *matrix, int *erased);
+
+/* Whether ml_plan_decode() can decode erased[], remembered per pattern. */
+
+int ml_plan_decodable(int *matrix, int *erased);
+
+/* Repair plans leave the stored cells of the erased nodes in their buffers
+   and read only the cells flagged in reads[] (bit t of reads[i] for cell t
+   of node i).
+
+   ml_plan_rebuild() decodes everything and re-encodes and re-couples the
+   cells of the erased nodes; it reads every surviving cell.
+   ml_plan_repair() rebuilds the single node f from half of the sub-stripes
+   and sets reads[].  If minimal, only the helpers the solves need are read
+   and only the pairs they touch are uncoupled; otherwise every helper is
+   read and every pair inside those sub-stripes uncoupled.  Of the parity
+   rows that can serve, it takes those whose helpers have the lowest
+   highest load[] (a level per node, none if NULL), then the fewest.  A
+   parity node is no different: each solve decodes the one data symbol
+   coupled out of the half and encodes f's row and its partner's from that
+   sub-stripe alone, so m0..m3 are rebuilt from 44 cells like the data
+   nodes.  ml_plan_combine() writes each lost cell as one combination of
+   the cells in reads[], from a solve of the whole stripe.  All return -1
+   if the erasures cannot be repaired that way. */
+
+int ml_plan_rebuild(ML_Plan *plan, int *matrix, int *erased);
+int ml_plan_repair(ML_Plan *plan, int *matrix, int f, int minimal, int *load, int *reads);
+int ml_plan_combine(ML_Plan *plan, int *matrix, int *erased, int *reads);
+
+int ml_plan_run(ML_Plan *plan, int *matrix, char **nodes, int blocksize, int off, int size);
+void ml_plan_free(ML_Plan *plan);
+
+/* Makes dst a copy of src with matrices of its own.  Returns -1 if out of
+   memory, dst then empty. */
+
+int ml_plan_copy(ML_Plan *dst, ML_Plan *src);
+
+/* Plans as text, one op per line, so they can be kept and run again without
+   planning.  ml_plan_read() checks every cell, layer and sub-stripe it reads
+   and returns -1 on anything malformed. */
+
+int ml_plan_write(FILE *fp, ML_Plan *plan);
+int ml_plan_read(FILE *fp, ML_Plan *plan);
+
+/* Fused decode: runs the plan one tile at a time so every uncoupling layer and
+   every sub-stripe solve touch the tile while it is cache resident.  If fdata
+   is not NULL the decoded tile is also scattered into the ML_SUBS sub-stripe
+   buffers of k*blocksize bytes. */
+
+int ml_decode_tiled(ML_Plan *plan, int *matrix, char **nodes, int blocksize, int tile, char **fdata);
+
+/* Verify and locate.  ml_decode_verified() decodes out of place, leaving the
+   node buffers as stored: each tile is decoded into a scratch stripe,
+   scattered into fdata, then re-encoded and re-coupled and compared with
+   the stored cells of every node not in erased[].  Returns 0 if the stripe
+   is consistent, 1 if some node holds silently corrupted data (fdata is then
+   not to be trusted), -1 on error.  Costs one re-encode per read on top of
+   the decode.
+
+   ml_locate_corrupt() then searches for the corrupt nodes, one and then two
+   at a time, as long as a parity is left over to check the guess against.
+   The nodes found are added to erased[] and their number returned, or -1 if
+   no such set exists. */
+
+int ml_decode_verified(ML_Plan *plan, int *matrix, char **nodes, int blocksize, int tile,
+                       int *erased, char **fdata);
+int ml_locate_corrupt(int *matrix, char **nodes, int blocksize, int tile, int *erased);
+
+#endif
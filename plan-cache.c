@@ -0,0 +1,56 @@
+/* plan-cache.c
+ * Fills a plan cache with the repair plan of every failed set of the
+ * multilayer code up to a number of nodes.
+
+   usage: plan-cache dir [maxfailed]
+
+   dir is the directory of ML_PLAN_CACHE (ml_repair.h); maxfailed is 2 by
+   default, every single and double failure, and at most ML_M.  Each set is
+   planned with the cheapest backend that can repair it and its plan written
+   to dir, so that repair, repair-1..4, rebuild and degraded-read pointed at
+   dir load their plans rather than make them.  The sets planned, the time
+   it took and the time the same sets take to look up again are printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jerasure.h"
+#include "galois.h"
+#include "timing.h"
+#include "multilayer.h"
+#include "ml_repair.h"
+
+int main(int argc, char **argv)
+{
+	struct timing t1, t2, t3;
+	int *matrix;
+	int maxfailed, planned;
+
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "usage: plan-cache dir [maxfailed]\n");
+		exit(0);
+	}
+	maxfailed = 2;
+	if (argc == 3 && (sscanf(argv[2], "%d", &maxfailed) != 1 || maxfailed < 1 || maxfailed > ML_M)) {
+		fprintf(stderr, "maxfailed must be 1 to %d\n", ML_M);
+		exit(0);
+	}
+	matrix = ml_coding_matrix(ML_K, ML_M, ML_W);
+	if (matrix == NULL) {
+		fprintf(stderr, "Cannot make the coding matrix\n");
+		exit(1);
+	}
+
+	timing_set(&t1);
+	planned = ml_repair_warm(matrix, maxfailed, argv[1]);
+	timing_set(&t2);
+	ml_repair_warm(matrix, maxfailed, argv[1]);
+	timing_set(&t3);
+
+	printf("Failed sets of up to %d nodes planned: %d\n", maxfailed, planned);
+	printf("Planning (sec): %0.6f\n", timing_delta(&t1, &t2));
+	printf("Looking up again (sec): %0.6f\n", timing_delta(&t2, &t3));
+	free(matrix);
+	return 0;
+}
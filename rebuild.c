@@ -0,0 +1,361 @@
+/* rebuild.c
+ * Rebuilds the failed node files of many files encoded by encoder.c, as
+ * after the loss of one disk or several.
+
+   usage: rebuild listfile node|all [io [compute [MB]]]
+
+   listfile names one input file per line, as given to encoder.c; blank
+   lines and lines starting with # are skipped.  The failed nodes of each
+   file are the ones whose node files are gone, as for repair.c.  If a node
+   (0..13) is given it is rebuilt in every file as well, whether its file is
+   gone or not; with all, files with no failed nodes are left alone.
+
+   The files are queued by risk: those with the fewest nodes to spare
+   first, and among those the ones with the least to read first, so the
+   files most at risk get back to safety soonest.  A file with more than
+   ML_M failed nodes cannot be repaired and is only reported.  The repair
+   plan of each failed set is made once (through the plan cache of
+   ML_PLAN_CACHE if set, see ml_repair.h) and shared by a pool of io+compute
+   worker threads, each repairing one file at a time in queue order.  At most io of them
+   read or write at once (default 4) and at most compute of them run the
+   plan at once (default 2).  Each repair streams the files through
+   buffers of at most MB megabytes (ML_REPAIR_MEMORY by default), so the
+   memory of the pool is bounded whatever the file sizes.
+
+   Before starting, the files and bytes to read at each number of lost
+   nodes are printed.  Progress is printed at most once a second, with the
+   expected time to safety at the rate so far: until no file has lost as
+   many nodes as the worst ones left, and until every file is whole.  The
+   totals, the time each number of lost nodes was cleared and the
+   throughput are printed at the end.  Files that cannot be repaired are
+   listed and make the exit status 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include "jerasure.h"
+#include "galois.h"
+#include "timing.h"
+#include "multilayer.h"
+#include "ml_io.h"
+#include "ml_repair.h"
+
+/* A file to repair.  lost is the number of failed nodes, bytes what the
+   plan reads from its helpers. */
+
+typedef struct {
+	char *name;
+	char *fnames[ML_NODES];
+	int readins;
+	int layout;
+	int plan;
+	int lost;
+	long bytes;
+} Job;
+
+typedef struct {
+	Job *jobs;
+	int njobs;
+	int next;
+	int done;
+	int failures;
+	long read;
+	long written;
+	int left[ML_M+1];             /* Jobs not done, by lost nodes */
+	long ahead[ML_M+1];           /* Bytes to read by jobs with that many or more */
+	double cleared[ML_M+1];       /* When the last of them was done, or -1 */
+	struct timing start;
+	struct timing last;
+	pthread_mutex_t lock;
+	sem_t io;
+	sem_t cpu;
+	ML_Repair *plans;
+	int nplans;
+	long mem;
+	int *matrix;
+} Pool;
+
+/* Most lost nodes first, then the least to read. */
+
+static int job_compare(const void *a, const void *b)
+{
+	const Job *x, *y;
+
+	x = (const Job *) a;
+	y = (const Job *) b;
+	if (x->lost != y->lost) return y->lost - x->lost;
+	if (x->bytes != y->bytes) return (x->bytes < y->bytes) ? -1 : 1;
+	return 0;
+}
+
+/* Prints the jobs left at the worst risk and the time to clear them and all
+   of the jobs, at the read rate so far.  Called with the lock held. */
+
+static void print_progress(Pool *p, double sec)
+{
+	double rate;
+	int l;
+
+	rate = (sec > 0) ? p->read/sec : 0;
+	printf("%d/%d files, %ld bytes written, %.1f MB/s", p->done, p->njobs, p->written, rate/(1024*1024));
+	for (l = ML_M; l > 0 && p->left[l] == 0; l--) ;
+	if (l > 0 && rate > 0) {
+		printf(", %d with %d lost safe in %.1f s, all in %.1f s", p->left[l], l,
+		       (p->ahead[l] > p->read) ? (p->ahead[l]-p->read)/rate : 0,
+		       (p->ahead[1] > p->read) ? (p->ahead[1]-p->read)/rate : 0);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+static void *worker(void *arg)
+{
+	Pool *p;
+	Job *jb;
+	struct stat status;
+	struct timing now;
+	ML_IO_Account acct;
+	long size;
+	int i, j, rv;
+
+	p = (Pool *) arg;
+	while (1) {
+		pthread_mutex_lock(&p->lock);
+		i = p->next++;
+		pthread_mutex_unlock(&p->lock);
+		if (i >= p->njobs) break;
+
+		jb = p->jobs + i;
+		acct.total = 0;
+		size = 0;
+		rv = ml_repair_exec(p->plans + jb->plan, p->matrix, jb->fnames, jb->readins, jb->layout, p->mem,
+		                    &p->io, &p->cpu, &acct);
+		if (rv == 0) {
+			for (j = 0; j < ML_NODES; j++) {
+				if (p->plans[jb->plan].failed[j] && stat(jb->fnames[j], &status) == 0) size += status.st_size;
+			}
+		}
+
+		pthread_mutex_lock(&p->lock);
+		p->done++;
+		if (rv < 0) {
+			p->failures++;
+			fprintf(stderr, "Cannot rebuild %s\n", jb->name);
+		}
+		p->read += acct.total;
+		p->written += size;
+		timing_set(&now);
+		if (--p->left[jb->lost] == 0) p->cleared[jb->lost] = timing_delta(&p->start, &now);
+		if (timing_delta(&p->last, &now) >= 1 || p->done == p->njobs) {
+			print_progress(p, timing_delta(&p->start, &now));
+			p->last = now;
+		}
+		pthread_mutex_unlock(&p->lock);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *fp;
+	Pool p;
+	Job *jb;
+	pthread_t *threads;
+	struct timing t2;
+	struct stat status;
+	char *line, *s;
+	char **objects;
+	int failed[ML_NODES];
+	int load[ML_NODES];
+	int *masks;
+	int *unplanned;			/* Failed sets no plan was found for */
+	int i, j, l, mask, node, nio, ncpu, nthreads, nobjects, alloc, lost, bad, nunplanned;
+	double sec;
+
+	if (argc < 3 || argc > 6) {
+		fprintf(stderr, "usage: rebuild listfile node|all [io [compute [MB]]]\n");
+		exit(0);
+	}
+	node = -1;
+	if (strcmp(argv[2], "all") != 0 &&
+	    (sscanf(argv[2], "%d", &node) != 1 || node < 0 || node >= ML_NODES)) {
+		fprintf(stderr, "Bad node %s\n", argv[2]);
+		exit(0);
+	}
+	nio = 4;
+	ncpu = 2;
+	if ((argc > 3 && (sscanf(argv[3], "%d", &nio) != 1 || nio <= 0)) ||
+	    (argc > 4 && (sscanf(argv[4], "%d", &ncpu) != 1 || ncpu <= 0))) {
+		fprintf(stderr, "Bad worker count\n");
+		exit(0);
+	}
+	p.mem = 0;
+	if (argc > 5) {
+		if (sscanf(argv[5], "%ld", &p.mem) != 1 || p.mem <= 0) {
+			fprintf(stderr, "Bad memory cap %s\n", argv[5]);
+			exit(0);
+		}
+		p.mem <<= 20;
+	}
+
+	/* Read the list of files */
+	fp = fopen(argv[1], "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "Cannot open %s\n", argv[1]);
+		exit(1);
+	}
+	alloc = 64;
+	objects = (char **)malloc(sizeof(char *)*alloc);
+	nobjects = 0;
+	line = (char *)malloc(sizeof(char)*4096);
+	while (fgets(line, 4096, fp) != NULL) {
+		s = line + strspn(line, " \t");
+		s[strcspn(s, "\r\n")] = '\0';
+		if (*s == '\0' || *s == '#') continue;
+		if (nobjects == alloc) {
+			alloc *= 2;
+			objects = (char **)realloc(objects, sizeof(char *)*alloc);
+		}
+		objects[nobjects++] = strdup(s);
+	}
+	fclose(fp);
+	free(line);
+
+	/* Scan every file for its failed nodes, and make one plan per failed
+	   set.  A set that cannot be planned is remembered as well, so it is
+	   tried once rather than once per file.  Planning also sets up the GF
+	   tables before the workers share them. */
+	p.matrix = ml_coding_matrix(ML_K, ML_M, ML_W);
+	p.jobs = (Job *)malloc(sizeof(Job)*(nobjects > 0 ? nobjects : 1));
+	p.plans = (ML_Repair *)malloc(sizeof(ML_Repair)*(nobjects > 0 ? nobjects : 1));
+	masks = (int *)malloc(sizeof(int)*(nobjects > 0 ? nobjects : 1));
+	unplanned = (int *)malloc(sizeof(int)*(nobjects > 0 ? nobjects : 1));
+	p.njobs = 0;
+	p.nplans = 0;
+	nunplanned = 0;
+	bad = 0;
+	for (i = 0; i < nobjects; i++) {
+		jb = p.jobs + p.njobs;
+		jb->name = objects[i];
+		if (ml_object_open(objects[i], jb->fnames, &jb->readins, &jb->layout, NULL) < 0) {
+			fprintf(stderr, "Cannot read the metadata of %s\n", objects[i]);
+			bad++;
+			continue;
+		}
+		lost = ml_find_failed(ML_NODES, jb->fnames, failed);
+		if (node >= 0 && !failed[node]) {
+			failed[node] = 1;
+			lost++;
+		}
+		mask = 0;
+		for (j = 0; j < ML_NODES; j++) {
+			if (failed[j]) mask |= (1 << j);
+		}
+		jb->plan = -1;
+		if (lost > 0 && lost <= ML_M) {
+			for (j = 0; j < p.nplans && masks[j] != mask; j++) ;
+			for (l = 0; j == p.nplans && l < nunplanned && unplanned[l] != mask; l++) ;
+			if (j == p.nplans && l == nunplanned) {
+				if (ml_repair_plan(p.plans+j, -1, p.matrix, failed,
+				                   (ml_repair_loads(failed, load) > 0) ? load : NULL,
+				                   getenv(ML_REPAIR_CACHE), NULL) >= 0) {
+					masks[p.nplans++] = mask;
+				} else {
+					unplanned[nunplanned++] = mask;
+				}
+			}
+			if (j < p.nplans) jb->plan = j;
+		}
+		if (jb->plan < 0) {
+			if (lost > 0) {
+				fprintf(stderr, "Cannot repair %s: %d nodes lost\n", objects[i], lost);
+				bad++;
+			}
+			ml_object_free(jb->fnames);
+			continue;
+		}
+
+		/* Every cell of a node file is size/ML_SUBS bytes over the read-ins */
+		jb->lost = lost;
+		jb->bytes = 0;
+		for (j = 0; j < ML_NODES; j++) {
+			if (!failed[j] && stat(jb->fnames[j], &status) == 0) {
+				jb->bytes = p.plans[jb->plan].read_cells * (status.st_size/ML_SUBS);
+				break;
+			}
+		}
+		p.njobs++;
+	}
+	qsort(p.jobs, p.njobs, sizeof(Job), job_compare);
+
+	memset(p.left, 0, sizeof(p.left));
+	memset(p.ahead, 0, sizeof(p.ahead));
+	for (l = 0; l <= ML_M; l++) p.cleared[l] = -1;
+	for (i = 0; i < p.njobs; i++) {
+		p.left[p.jobs[i].lost]++;
+		for (l = 1; l <= p.jobs[i].lost; l++) p.ahead[l] += p.jobs[i].bytes;
+	}
+	for (l = ML_M; l > 0; l--) {
+		if (p.left[l] > 0) {
+			printf("%d lost: %d files, %ld bytes to read\n", l, p.left[l], p.ahead[l] - ((l < ML_M) ? p.ahead[l+1] : 0));
+		}
+	}
+	for (i = 0; i < p.nplans; i++) {
+		printf("Nodes");
+		for (j = 0; j < ML_NODES; j++) if (p.plans[i].failed[j]) printf(" %d", j);
+		printf(": %s (%s)\n", ml_backends[p.plans[i].backend].name, ml_backends[p.plans[i].backend].program);
+	}
+	printf("Rebuilding %d of %d files with %d I/O and %d compute workers\n", p.njobs, nobjects, nio, ncpu);
+	fflush(stdout);
+
+	p.next = 0;
+	p.done = 0;
+	p.failures = 0;
+	p.read = 0;
+	p.written = 0;
+	pthread_mutex_init(&p.lock, NULL);
+	sem_init(&p.io, 0, nio);
+	sem_init(&p.cpu, 0, ncpu);
+	timing_set(&p.start);
+	p.last = p.start;
+
+	nthreads = nio + ncpu;
+	if (nthreads > p.njobs) nthreads = p.njobs;
+	threads = (pthread_t *)malloc(sizeof(pthread_t)*(nthreads > 0 ? nthreads : 1));
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(threads+i, NULL, worker, &p) != 0) {
+			fprintf(stderr, "Cannot start worker %d\n", i);
+			exit(1);
+		}
+	}
+	for (i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+	timing_set(&t2);
+
+	sec = timing_delta(&p.start, &t2);
+	printf("Rebuilt %d of %d files: read %ld bytes, wrote %ld bytes\n", p.njobs-p.failures, nobjects, p.read,
+	       p.written);
+	for (l = ML_M; l > 0; l--) {
+		if (p.cleared[l] >= 0) printf("Files with %d lost safe after (sec): %0.10f\n", l, p.cleared[l]);
+	}
+	printf("Rebuild time (sec): %0.10f\n", sec);
+	printf("Throughput (MB/sec): %0.10f\n", (sec > 0) ? p.written/sec/(1024*1024) : 0);
+
+	for (i = 0; i < p.njobs; i++) {
+		ml_object_free(p.jobs[i].fnames);
+	}
+	for (i = 0; i < p.nplans; i++) ml_repair_free(p.plans+i);
+	for (i = 0; i < nobjects; i++) free(objects[i]);
+	free(objects);
+	free(p.jobs);
+	free(p.plans);
+	free(masks);
+	free(unplanned);
+	free(threads);
+	free(p.matrix);
+	return p.failures > 0 || bad > 0;
+}
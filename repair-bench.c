@@ -0,0 +1,183 @@
+/* repair-bench.c
+ * Compares star and chain repair (ml_net.h) of a file encoded by encoder.c.
+
+   usage: repair-bench inputfile [MB/s [node ...]]
+
+   For one failed node and then two (nodes 3, then 3 and 12, unless nodes
+   are given, in which case only that set is run), the failed node files
+   are taken away, rebuilt once by a star of helpers sending their cells to
+   the repairer (net-raw) and once by a chain of helpers, timed, and
+   compared with the originals, which are put back afterwards.  All node
+   files must be present.  A link speed in MB/s (default 100) is imposed on
+   every process, since over local sockets the two would take about the
+   same time.  The bytes the repairer receives and the time of each are
+   printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "jerasure.h"
+#include "galois.h"
+#include "timing.h"
+#include "multilayer.h"
+#include "ml_io.h"
+#include "ml_repair.h"
+#include "ml_net.h"
+
+#define NSETS 2
+
+static char *load(char *fname, long *size)
+{
+	FILE *fp;
+	struct stat status;
+	char *buf;
+
+	fp = fopen(fname, "rb");
+	if (fp == NULL || fstat(fileno(fp), &status) < 0) return NULL;
+	*size = status.st_size;
+	buf = (char *)malloc(sizeof(char)*(*size > 0 ? *size : 1));
+	if (buf == NULL || fread(buf, sizeof(char), *size, fp) != (size_t) *size) {
+		fclose(fp);
+		free(buf);
+		return NULL;
+	}
+	fclose(fp);
+	return buf;
+}
+
+static int store(char *fname, char *buf, long size)
+{
+	FILE *fp;
+
+	fp = fopen(fname, "wb");
+	if (fp == NULL) return -1;
+	if (fwrite(buf, sizeof(char), size, fp) != (size_t) size) {
+		fclose(fp);
+		return -1;
+	}
+	return fclose(fp);
+}
+
+int main(int argc, char **argv)
+{
+	char *fnames[ML_NODES];
+	char *orig[ML_NODES], *got;
+	char names[3*ML_NODES+1];
+	int *matrix;
+	int sets[NSETS][ML_NODES];
+	int failed[ML_NODES];
+	int i, readins, layout, nsets, s, chain, rv, ok;
+	long size[ML_NODES], gsize, blocksize, ingress;
+	double rate, sec[2];
+	struct timing t1, t2;
+	ML_Repair rp;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: repair-bench inputfile [MB/s [node ...]]\n");
+		exit(0);
+	}
+	rate = 100;
+	if (argc > 2 && (sscanf(argv[2], "%lf", &rate) != 1 || rate <= 0)) {
+		fprintf(stderr, "Bad link speed %s\n", argv[2]);
+		exit(0);
+	}
+	rate *= 1024*1024;
+
+	memset(sets, 0, sizeof(sets));
+	if (argc > 3) {
+		nsets = 1;
+		for (i = 3; i < argc; i++) {
+			if (sscanf(argv[i], "%d", &s) != 1 || s < 0 || s >= ML_NODES) {
+				fprintf(stderr, "Bad node %s\n", argv[i]);
+				exit(0);
+			}
+			sets[0][s] = 1;
+		}
+	} else {
+		nsets = 2;
+		sets[0][3] = 1;
+		sets[1][3] = 1;
+		sets[1][12] = 1;
+	}
+
+	if (ml_object_open(argv[1], fnames, &readins, &layout, NULL) < 0) {
+		exit(1);
+	}
+	matrix = ml_coding_matrix(ML_K, ML_M, ML_W);
+	if (ml_find_failed(ML_NODES, fnames, failed) != 0) {
+		fprintf(stderr, "All node files must be present\n");
+		exit(1);
+	}
+
+	/* Keep the files of every node that fails in some set */
+	for (i = 0; i < ML_NODES; i++) {
+		orig[i] = NULL;
+		for (s = 0; s < nsets; s++) {
+			if (sets[s][i]) break;
+		}
+		if (s == nsets) continue;
+		orig[i] = load(fnames[i], size+i);
+		if (orig[i] == NULL) {
+			fprintf(stderr, "Cannot read %s\n", fnames[i]);
+			exit(1);
+		}
+	}
+	for (i = 0; orig[i] == NULL; i++) ;
+	blocksize = size[i]/(ML_SUBS*readins);
+
+	printf("Link speed %.1f MB/s, %d read-ins of %ld-byte cells\n", rate/(1024*1024), readins, blocksize);
+	printf("%-12s %-6s %14s %12s %s\n", "Failed", "Repair", "Ingress", "Time (sec)", "Result");
+	rv = 0;
+	for (s = 0; s < nsets; s++) {
+		if (ml_repair_estimate(&rp, ML_REPAIR_JOINT, matrix, sets[s], NULL) < 0 &&
+		    ml_repair_estimate(&rp, ML_REPAIR_INVERSE, matrix, sets[s], NULL) < 0) {
+			fprintf(stderr, "Set %d cannot be repaired\n", s);
+			exit(1);
+		}
+		for (chain = 0; chain < 2; chain++) {
+			for (i = 0; i < ML_NODES; i++) {
+				if (sets[s][i]) unlink(fnames[i]);
+			}
+			timing_set(&t1);
+			if (chain) {
+				i = ml_chain_repair(matrix, fnames, sets[s], readins, layout, 0, rate, NULL);
+			} else {
+				i = ml_net_repair(matrix, fnames, sets[s], readins, layout, 0, rate, NULL);
+			}
+			timing_set(&t2);
+			sec[chain] = timing_delta(&t1, &t2);
+
+			/* Compare, and put the originals back whatever happened */
+			ok = (i == 0);
+			for (i = 0; i < ML_NODES; i++) {
+				if (!sets[s][i]) continue;
+				got = load(fnames[i], &gsize);
+				if (got == NULL || gsize != size[i] || memcmp(got, orig[i], size[i]) != 0) ok = 0;
+				free(got);
+				if (store(fnames[i], orig[i], size[i]) < 0) {
+					fprintf(stderr, "Cannot restore %s\n", fnames[i]);
+					exit(1);
+				}
+			}
+			if (!ok) rv = 1;
+
+			ingress = (chain ? rp.plan.nops : rp.read_cells)*blocksize*readins;
+			names[0] = '\0';
+			for (i = 0; i < ML_NODES; i++) {
+				if (sets[s][i]) sprintf(names+strlen(names), "%s%d", (names[0] == '\0') ? "" : ",", i);
+			}
+			printf("%-12s %-6s %14ld %12.6f %s\n", names, chain ? "chain" : "star", ingress, sec[chain],
+			       ok ? "ok" : "MISMATCH");
+		}
+		printf("%-12s %-6s %14s %12.2fx\n", "", "", "speedup", sec[0]/sec[1]);
+		ml_repair_free(&rp);
+	}
+
+	for (i = 0; i < ML_NODES; i++) free(orig[i]);
+	ml_object_free(fnames);
+	free(matrix);
+	return rv;
+}
@@ -0,0 +1,101 @@
+/* repair.c
+ * Rebuilds the node files of failed nodes of a file encoded by encoder.c.
+
+   usage: repair inputfile [inverse|subset|full|layered|joint|net|net-raw|chain [MB/s]]
+
+   Nodes whose files are missing from Coding/ are the failed ones.  Every
+   repair strategy of repair-1..4 is priced for that set (ml_repair.h) and
+   the cheapest valid one is used, unless one is named on the command line.
+   net and net-raw run the inverse repair with one helper process per node
+   read, over Unix-domain sockets (ml_net.h); the helpers send their
+   combined part of the lost cells, or for net-raw their cells as read.
+   chain passes the partial lost cells from helper to helper instead.  For
+   these three a link speed in MB/s may follow, which every helper and the
+   repairer then keep to.
+   Only the cells the strategy needs are read from the helpers, and the
+   failed node files are written back in place, in the layout the metadata
+   names (ml_io.h).  The choice and the predicted and actual bytes read are
+   printed at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "jerasure.h"
+#include "galois.h"
+#include "multilayer.h"
+#include "ml_io.h"
+#include "ml_repair.h"
+#include "ml_net.h"
+
+int main(int argc, char **argv)
+{
+	char *fnames[ML_NODES];
+	int *matrix;
+	int failed[ML_NODES];
+	int i, readins, backend, layout, net;
+	double rate;
+
+	net = (argc >= 3 && (strncmp(argv[2], "net", 3) == 0 || strcmp(argv[2], "chain") == 0));
+	if (argc != 2 && argc != 3 && !(argc == 4 && net)) {
+		fprintf(stderr, "usage: repair inputfile [inverse|subset|full|layered|joint|net|net-raw|chain [MB/s]]\n");
+		exit(0);
+	}
+	rate = 0;
+	if (argc == 4 && (sscanf(argv[3], "%lf", &rate) != 1 || rate <= 0)) {
+		fprintf(stderr, "Bad link speed %s\n", argv[3]);
+		exit(0);
+	}
+	rate *= 1024*1024;
+
+	if (ml_object_open(argv[1], fnames, &readins, &layout, NULL) < 0) {
+		exit(1);
+	}
+	matrix = ml_coding_matrix(ML_K, ML_M, ML_W);
+
+	/* Failed nodes are the ones whose files are gone */
+	if (ml_find_failed(ML_NODES, fnames, failed) == 0) {
+		printf("No failed nodes\n");
+		exit(0);
+	}
+	printf("Failed nodes:");
+	for (i = 0; i < ML_NODES; i++) if (failed[i]) printf(" %d", i);
+	printf("\n");
+
+	if (net) {
+		if (strcmp(argv[2], "chain") == 0) {
+			i = ml_chain_repair(matrix, fnames, failed, readins, layout, 0, rate, stdout);
+		} else if (strcmp(argv[2], "net") == 0 || strcmp(argv[2], "net-raw") == 0) {
+			i = ml_net_repair(matrix, fnames, failed, readins, layout, strcmp(argv[2], "net") == 0, rate, stdout);
+		} else {
+			fprintf(stderr, "Unknown strategy %s\n", argv[2]);
+			exit(0);
+		}
+		if (i < 0) {
+			fprintf(stderr, "Unsuccessful!\n");
+			exit(1);
+		}
+		exit(0);
+	}
+
+	/* Pick the strategy, or take the one named */
+	backend = -1;
+	if (argc == 3) {
+		for (backend = 0; backend < ML_REPAIR_BACKENDS; backend++) {
+			if (strcmp(argv[2], ml_backends[backend].name) == 0) break;
+		}
+		if (backend == ML_REPAIR_BACKENDS) {
+			fprintf(stderr, "Unknown strategy %s\n", argv[2]);
+			exit(0);
+		}
+	}
+	if (ml_repair_files(matrix, fnames, failed, backend, readins, layout, stdout) < 0) {
+		fprintf(stderr, "Unsuccessful!\n");
+		exit(1);
+	}
+
+	ml_object_free(fnames);
+	free(matrix);
+	return 0;
+}